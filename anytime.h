@@ -0,0 +1,113 @@
+// Limits on how many maps a solver searches, how long it runs, and how much memory it uses,
+// so that a caller gets an answer in bounded time, even if it's only the best progress so far
+//
+// anytime_node() is called once per searched map, and only looks at the clock and the memory
+// every ANYTIME_CHECK_INTERVAL maps, since those are system calls
+
+#ifndef ANYTIME_H
+#define ANYTIME_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ANYTIME_CHECK_INTERVAL 4096
+
+struct anytime {
+	// 0 means no limit
+	size_t max_nodes;
+	double timeout; // Seconds
+	size_t max_memory; // Bytes
+
+	double start;
+	size_t nodes;
+	const char *limit; // The limit that was hit, or NULL
+	long other_rss; // The max rss of the other processes of a search that's split over several, in KiB
+};
+
+static double anytime_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Parses argv[*i] if it's one of the limit flags, and returns whether it was
+static bool anytime_parse(struct anytime *a, int argc, char *argv[], int *i) {
+	if (*i + 1 >= argc) {
+		return false;
+	}
+	if (strcmp(argv[*i], "--max-nodes") == 0) {
+		a->max_nodes = strtoull(argv[++*i], NULL, 10);
+	} else if (strcmp(argv[*i], "--timeout") == 0) {
+		a->timeout = strtod(argv[++*i], NULL);
+	} else if (strcmp(argv[*i], "--max-memory") == 0) {
+		a->max_memory = strtoull(argv[++*i], NULL, 10) << 20;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void anytime_start(struct anytime *a) {
+	a->start = anytime_now();
+}
+
+static size_t anytime_rss(void) {
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		return 0;
+	}
+	size_t size;
+	size_t resident = 0;
+	if (fscanf(f, "%zu %zu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Returns whether a limit was hit
+static bool anytime_node(struct anytime *a) {
+	a->nodes++;
+
+	if (a->max_nodes != 0 && a->nodes >= a->max_nodes) {
+		a->limit = "max-nodes";
+	} else if (a->nodes % ANYTIME_CHECK_INTERVAL != 0) {
+		return false;
+	} else if (a->timeout > 0 && anytime_now() - a->start >= a->timeout) {
+		a->limit = "timeout";
+	} else if (a->max_memory != 0 && anytime_rss() > a->max_memory) {
+		a->limit = "max-memory";
+	}
+
+	return a->limit != NULL;
+}
+
+// status is "solved", "unsolved" or "limit"
+static void anytime_print(const struct anytime *a, const char *status) {
+	printf("status: %s\n", status);
+	if (a->limit) {
+		printf("limit: %s\n", a->limit);
+	}
+	printf("nodes: %zu\n", a->nodes);
+	printf("seconds: %.3f\n", anytime_now() - a->start);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("max rss: %ld MiB\n", (usage.ru_maxrss + a->other_rss) >> 10); // ru_maxrss is in KiB
+}
+
+// The same as anytime_print(), but as key=value fields on a single line
+static inline void anytime_print_fields(FILE *f, const struct anytime *a, const char *status) {
+	fprintf(f, "status=%s", status);
+	if (a->limit) {
+		fprintf(f, " limit=%s", a->limit);
+	}
+	fprintf(f, " nodes=%zu seconds=%.3f", a->nodes, anytime_now() - a->start);
+}
+
+#endif
@@ -1,31 +1,58 @@
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-#define MAX_HEIGHT 16
-#define MAX_WIDTH 16
+#include "anytime.h"
+#include "bench.h"
+#include "cache.h"
+#include "perf.h"
+#include "preprocess.h"
+#include "deadlock.h"
+#include "distances.h"
+#include "key.h"
+#include "levels.h"
+#include "matching.h"
+#include "pages.h"
+#include "rank.h"
+
+#define MAX_HEIGHT PREPROCESS_MAX_HEIGHT
+#define MAX_WIDTH PREPROCESS_MAX_WIDTH
 
 #define MAX_PATH_LENGTH 420420
 #define MAX_MAPS 42420420
 #define MAX_MAP_STRING_LENGTH 420420
 #define MAX_MAP_STRINGS_CHARS 420420420
 
+#define CHECKPOINT_MAGIC "SOKOAREA"
+#define CHECKPOINT_VERSION 3
+#define PAGE_SIZE 4096
+#define PAGE_ALIGN(n) (((n) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1))
+
+#define DEADLOCKED INT32_MAX // The budget of a map that can't be solved, no matter how deep the search goes
+
+#define NO_SQUARE UINT16_MAX
+
+_Static_assert(MAX_WIDTH * MAX_HEIGHT <= DEADLOCK_SQUARES, "deadlock.h needs a bit for every tile");
+
+typedef uint8_t u8;
+typedef uint16_t u16;
 typedef uint32_t u32;
+typedef int32_t i32;
 typedef int64_t i64;
-
-enum tile {
-	FLOOR,
-	WALL,
-	BOX,
-	STORAGE,
-	STORED_BOX,
-};
+typedef uint64_t u64;
 
 enum push_direction {
 	pushing_up    = 0x1,
@@ -40,11 +67,92 @@ struct move {
 	enum push_direction direction;
 };
 
+// The first page of a checkpoint file, followed by the memo tables exactly as they are laid out in memory
+struct checkpoint_header {
+	char magic[8];
+	u32 version;
+	u32 level_hash;
+	size_t max_maps;
+	size_t max_map_strings_chars;
+	size_t max_depth;
+	size_t current_solve_calls;
+	size_t total_solve_calls;
+	size_t maps_size;
+	size_t map_strings_size;
+	u64 ranked_maps; // 0 if the maps were hashed
+};
+
+// A memo entry whose subtree is still being searched, along with the budget it had before this visit
+struct in_progress {
+	u32 index;
+	i32 previous_budget;
+};
+
+// A map that was recorded for the benchmarks
+struct bench_state {
+	enum tile map[MAX_HEIGHT][MAX_WIDTH];
+	size_t x; // Where the player is
+	size_t y;
+	size_t top_left_index;
+	i64 empty_storages;
+};
+
+enum push {
+	PUSHED_BOX,
+	PUSHED_STORED_BOX,
+};
+
+// A map on the search stack, along with everything that is needed to undo the push it's currently trying
+struct frame {
+	size_t x; // Where the player is
+	size_t y;
+	u32 index;
+	i32 budget;
+	u64 discovery;
+	u64 outer_cycle;
+	size_t cutoffs_before;
+	size_t pending_before;
+
+	u8 *pushable; // The directions the box on each tile can be pushed in, at px + py * width
+	size_t first_tile; // The tile that the pushes start from, after which they wrap around
+	size_t tile; // The tile whose box is being pushed, as px + py * width, plus width * height once they wrapped around
+	u8 order; // Which of push_orders the directions are tried in
+	u8 direction; // The next direction to push that box in
+	bool moved;
+	enum push move;
+	bool deadlocked;
+	struct matching_undo undo;
+};
+
+// What the workers of --workers share besides the memo tables, in a shared mapping, so it's only ever touched atomically
+struct lazy_smp {
+	size_t maps_size;
+	size_t map_strings_size;
+	size_t finished; // How many times any worker finished searching a max_depth
+	size_t searched; // The solve() calls of every worker, over the max_depths they all finished
+	u32 winner; // 1 + the worker that found a solution or hit a limit, which prints it, or 0
+	bool limited; // Whether the winner hit a limit
+	size_t nodes; // The nodes of every worker that stopped
+};
+
+// A map of --greedy or --beam, with how good it looks, where lower is better
+struct scored {
+	u64 score;
+	u32 index;
+};
+
 static enum tile map[MAX_HEIGHT][MAX_WIDTH];
 
 static size_t width = 0;
 static size_t height = 0;
 
+// Where the cropped map starts in the original one
+static size_t origin_x;
+static size_t origin_y;
+
+// Boxes on storage that got turned into walls, which are still printed as boxes
+static bool frozen[MAX_HEIGHT][MAX_WIDTH];
+
 static i64 empty_storages = 0;
 
 static size_t current_solve_calls;
@@ -55,18 +163,131 @@ static size_t max_depth = 1;
 static struct move path[MAX_PATH_LENGTH];
 static size_t path_length;
 
-static char *maps[MAX_MAPS];
-static size_t map_depths[MAX_MAPS];
+// The pushes to the map with the fewest empty storages so far, which is what a search that hits a limit reports
+static i64 best_empty_storages;
+static struct move best_path[MAX_PATH_LENGTH];
+static size_t best_path_length;
+
+static struct anytime anytime;
+
+static struct perf perf; // Only enabled with --perf
+
+// With --bench, the search only records maps, which the kernels are then benchmarked on
+static bool benchmarking;
+static struct bench bench;
+static struct bench_state bench_states[BENCH_MAX_SAMPLES];
+
+static struct cache cache = {.variant="area"};
+static bool from_cache; // Whether the result came out of the cache, so it doesn't need to be stored again
+
+// Index 0 is never used, so that a 0 in buckets or chains can mean "end of chain"
+// This lets a fresh or resumed table start out as all zero pages
+static u32 *map_offsets;
+static i32 *map_budgets; // How many more pushes the map was searched for, plus one, so that 0 means it never finished
 static size_t maps_size;
 
 static char map_string[MAX_MAP_STRING_LENGTH];
 static size_t map_string_length;
 
-static char map_strings[MAX_MAP_STRINGS_CHARS];
+// The memo table is keyed by which floor tiles have a box and the top left tile the player can reach, see key.h
+static struct key_format key_format;
+static u16 floor_indices[MAX_HEIGHT][MAX_WIDTH];
+static u8 floor_x[MAX_HEIGHT * MAX_WIDTH];
+static u8 floor_y[MAX_HEIGHT * MAX_WIDTH];
+static size_t floors_size;
+
+static char *map_strings;
 static size_t map_strings_size;
 
-static u32 buckets[MAX_MAPS];
-static u32 chains[MAX_MAPS];
+static u32 *buckets;
+static u32 *chains;
+
+static char *tables;
+static size_t tables_size;
+static struct pages pages; // Where the memo tables got their pages from, see pages.h
+
+static struct in_progress in_progress[MAX_PATH_LENGTH];
+
+// solve() used to recurse once per push, so the search keeps its own stack instead
+static struct frame frames[MAX_PATH_LENGTH + 1];
+
+// The pushable tiles of every frame, width * height bytes each, so that the frames of a small map stay small
+static u8 *pushables;
+
+static u32 level_hash;
+
+static const char *checkpoint_path = "area.checkpoint";
+static unsigned checkpoint_interval;
+static volatile sig_atomic_t checkpoint_requested;
+static volatile sig_atomic_t exit_requested;
+
+// Matches boxes with storages, for a lower bound on the number of pushes that are still needed
+static struct matching matching;
+static bool use_matching;
+static u8 box_ids[MAX_HEIGHT][MAX_WIDTH]; // The matching's column of the box on each tile, or 0
+
+// The pushes it takes to get a box from each tile onto each storage
+static struct distances distances;
+static bool dead_tiles[MAX_HEIGHT][MAX_WIDTH]; // Tiles that a box mustn't be pushed onto
+static bool use_nearest; // Whether the boxes' fewest pushes to any storage are the lower bound, for when there's no matching
+static size_t nearest_total;
+
+// Learns which groups of boxes are deadlocked
+static struct deadlocks deadlocks;
+static bool use_deadlocks;
+static const char *deadlocks_path;
+static u64 box_tiles[DEADLOCK_WORDS];
+
+// When every map the search could run into fits in the memo table, a map's index is its rank,
+// so it doesn't need to be stringified, hashed, or compared
+static struct ranking ranking;
+static bool use_ranking;
+static u16 box_squares[MAX_HEIGHT][MAX_WIDTH]; // The ranking's square of each tile a box can be on, or NO_SQUARE
+static u16 player_squares[MAX_HEIGHT][MAX_WIDTH];
+static size_t player_squares_size;
+
+// How often the search got cut short by how deep it was allowed to go
+// A subtree that finishes without increasing this is deadlocked,
+// as long as it didn't go in a circle back to a map above it
+static size_t cutoffs;
+
+// Maps are numbered in the order they are searched, like in Tarjan's strongly connected components algorithm
+// A map that went in a circle waits on the pending stack until the map it went back to is finished,
+// since they're either all deadlocked, or none of them are
+static u64 discoveries;
+static u64 shallowest_cycle = UINT64_MAX; // The earliest discovered map that the current subtree went in a circle back to
+static u32 pending[MAX_MAPS];
+static size_t pending_size;
+static u64 *pending_discoveries; // 0 if the map isn't pending; probed by map index like the memo table, so it's on huge pages too
+
+// Lazy SMP: with --workers, forked processes search every max_depth side by side over the shared memo tables,
+// each trying the pushes of a map in another order, so that they mostly end up in different subtrees,
+// which the others then find in the memo tables instead of searching them again
+static size_t workers = 1;
+static size_t worker; // 0 for the process that was started, which prints the progress
+static struct lazy_smp *lazy_smp;
+static u32 *stack_depths; // The depth at which a map is on this worker's search stack, or 0; the memo tables only get the budgets of finished maps
+static u8 push_orders[24][4]; // Every order of the bits of push_direction that solve() can try them in, the first one being theirs
+static u8 later_pushes[24][5]; // The directions at or after each position of each order
+
+// With --seed, every map tries its pushes from a random tile on, in a random order of the directions, see enter()
+// With --restarts, solve() gives up on a max_depth once it searched the next number of the Luby sequence times restart_unit maps,
+// and searches it again with the next random stream, see restart()
+static bool seeded;
+static u64 seed;
+static u64 rng;
+static size_t restart_unit; // 0 without --restarts
+static size_t runs; // How many times solve() was called so far
+static size_t restarts; // How many of those runs gave up
+static size_t run_end; // The current_solve_calls at which the current run gives up
+
+// --greedy and --beam search the same pushes as solve(), but always go on from the maps that score best, see search_by_score()
+static bool greedy;
+static size_t beam_width; // 0 without --beam
+static size_t open_memory; // The bytes that the open list of --greedy can take up, or 0 for no limit
+static u32 *parents; // The map that every map was first pushed to from, by memo index, or 0 for the start
+static u32 *parent_pushes; // The tile of the box that got pushed there, times 4, plus the bit of the direction
+static size_t dropped; // The maps that --greedy dropped from a full open list, so running out of maps proves nothing
 
 static char tile_to_char(enum tile t) {
 	switch (t) {
@@ -104,7 +325,28 @@ static void print_area_stats(void) {
 	printf("current_solve_calls: %zu\n", current_solve_calls);
 	printf("total_solve_calls: %zu\n", total_solve_calls);
 	printf("branching factor: %.2f\n", pow(current_solve_calls, 1.0/max_depth)); // O(branching_factor ^ depth)
-	printf("'wasted' solve() calls on iterative deepening: %.2f%%\n\n", (double)(total_solve_calls - current_solve_calls) / total_solve_calls * 100);
+	if (use_deadlocks) {
+		printf("deadlock patterns: %zu learned, %zu matched\n", deadlocks.learned, deadlocks.matched);
+	}
+	if (restart_unit > 0) {
+		printf("restarts: %zu of %zu runs gave up\n", restarts, runs);
+	}
+	pages_print(&pages);
+	if (total_solve_calls > 0) { // A cache hit doesn't search at all
+		printf("'wasted' solve() calls on iterative deepening: %.2f%%\n", (double)(total_solve_calls - current_solve_calls) / total_solve_calls * 100);
+	}
+	printf("\n");
+}
+
+static void print_moves(const struct move *moves, size_t moves_length) {
+	for (size_t i = 0; i < moves_length; i++) {
+		struct move m = moves[i];
+		printf("Push %s (%zu,%zu)\n",
+			m.direction == pushing_up ? "up" :
+			m.direction == pushing_down ? "down" :
+			m.direction == pushing_left ? "left" : "right"
+			, m.x + origin_x, m.y + origin_y);
+	}
 }
 
 static void print_map(void) {
@@ -114,35 +356,158 @@ static void print_map(void) {
 	printf("empty_storages: %zu\n", empty_storages);
 	printf("path_length: %zu\n", path_length);
 	printf("path:\n");
-	for (size_t i = 0; i < path_length; i++) {
-		struct move m = path[i];
-		printf("Push %s (%zu,%zu)\n",
-			m.direction == pushing_up ? "up" :
-			m.direction == pushing_down ? "down" :
-			m.direction == pushing_left ? "left" : "right"
-			, m.x, m.y);
-	}
+	print_moves(path, path_length);
 	printf("depth: %zu\n", max_depth);
 	for (size_t y = 0; y < height; y++) {
 		for (size_t x = 0; x < width; x++) {
-			printf("%c", tile_to_char(map[y][x]));
+			printf("%c", frozen[y][x] ? tile_to_char(STORED_BOX) : tile_to_char(map[y][x]));
 		}
 		printf("\n");
 	}
 	printf("\n");
 }
 
+// Pushes are cached as the direction's letter and the tile of the box in the cropped map, like "U3,4 L5,2"
+static void store_result(const char *status) {
+	static char pushes[MAX_PATH_LENGTH * 16];
+	size_t length = 0;
+	bool solved = strcmp(status, "solved") == 0;
+	for (size_t i = 0; solved && i < path_length && length + 64 < sizeof(pushes); i++) {
+		struct move m = path[i];
+		length += sprintf(pushes + length, "%s%c%zu,%zu", i > 0 ? " " : "",
+			m.direction == pushing_up ? 'U' :
+			m.direction == pushing_down ? 'D' :
+			m.direction == pushing_left ? 'L' : 'R'
+			, m.x, m.y);
+	}
+	pushes[length] = '\0';
+	cache_store(&cache, &anytime, status, solved ? path_length : 0, pushes);
+}
+
+static void print_result(const char *status) {
+	bool solved = strcmp(status, "solved") == 0;
+	if (!from_cache && (solved || strcmp(status, "unsolved") == 0)) {
+		store_result(status);
+	}
+
+	anytime_print(&anytime, status);
+
+	// A solution is already printed as the path
+	if (solved) {
+		return;
+	}
+	printf("best empty_storages: %zu\n", best_empty_storages);
+	printf("best path_length: %zu\n", best_path_length);
+	printf("best path:\n");
+	print_moves(best_path, best_path_length);
+}
+
+// Adds this worker's nodes to the total, which the first worker prints once the others stopped,
+// since the nodes that print_result() prints are only those of the worker that prints it
+static void finish_worker(void) {
+	__atomic_add_fetch(&lazy_smp->nodes, anytime.nodes, __ATOMIC_RELAXED);
+	if (worker > 0 || workers == 1) {
+		return;
+	}
+	while (wait(NULL) > 0) {}
+	printf("workers: %zu searched %zu maps in all\n", workers, __atomic_load_n(&lazy_smp->nodes, __ATOMIC_RELAXED));
+}
+
+// Another worker found a solution or hit a limit, and prints it itself
+static void stop_searching(void) {
+	finish_worker();
+	if (worker > 0) {
+		_exit(EXIT_SUCCESS);
+	}
+	exit(__atomic_load_n(&lazy_smp->limited, __ATOMIC_ACQUIRE) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// Every worker has the limits, and the first one to hit one stops them all, like a solution does
+static void hit_limit(void) {
+	u32 no_winner = 0;
+	if (!__atomic_compare_exchange_n(&lazy_smp->winner, &no_winner, worker + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		stop_searching();
+	}
+	__atomic_store_n(&lazy_smp->limited, true, __ATOMIC_RELEASE);
+	if (workers > 1) {
+		printf("workers: limit hit by worker %zu of %zu\n", worker, workers);
+	}
+	print_result("limit");
+	finish_worker();
+	exit(EXIT_FAILURE);
+}
+
 static void check_is_solved(void) {
-	if (empty_storages == 0) {
+	// A real search would've stopped here, so the recording does too
+	if (empty_storages == 0 && benchmarking) {
+		bench.solved = true;
+	}
+	if (empty_storages == 0 && !benchmarking) {
+		u32 no_winner = 0;
+		if (!__atomic_compare_exchange_n(&lazy_smp->winner, &no_winner, worker + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			stop_searching();
+		}
+		perf_begin(&perf, anytime.nodes);
 		printf("Solved!\n");
+		if (workers > 1) {
+			printf("workers: solved by worker %zu of %zu\n", worker, workers);
+		}
+		if (seeded) {
+			printf("seed: solved in run %zu of --seed %llu\n", runs, (unsigned long long)seed);
+		}
 		print_map();
+		print_result("solved");
+		perf_end(&perf, "output", anytime.nodes);
+		finish_worker();
 		exit(EXIT_SUCCESS);
 	}
 }
 
-static void solve(size_t x, size_t y, size_t depth, size_t top_left_index);
+// The matching's cost of a box on the tile, for the storage
+static int push_cost(size_t tile, size_t storage) {
+	u16 pushes = distances_get(&distances, tile, storage);
+	return pushes == DISTANCES_UNREACHABLE ? MATCHING_UNREACHABLE : pushes;
+}
+
+// Keeps the matching and the box tiles up to date with a box that got pushed from one tile to another
+// Returns whether the boxes now contain a learned deadlock pattern
+static bool move_box(size_t from_x, size_t from_y, size_t to_x, size_t to_y, struct matching_undo *undo) {
+	deadlock_remove(box_tiles, from_x + from_y * width);
+	deadlock_add(box_tiles, to_x + to_y * width);
+
+	if (use_matching) {
+		u8 id = box_ids[from_y][from_x];
+		box_ids[from_y][from_x] = 0;
+		box_ids[to_y][to_x] = id;
+
+		int costs[MATCHING_MAX];
+		for (size_t i = 0; i < matching.rows; i++) {
+			costs[i] = push_cost(to_x + to_y * width, i);
+		}
+		matching_move_box(&matching, id, costs, undo);
+	} else if (use_nearest) {
+		nearest_total += distances.nearest[to_x + to_y * width] - distances.nearest[from_x + from_y * width];
+	}
+
+	// The player always ends up where the box was
+	return use_deadlocks && deadlock_matches(&deadlocks, box_tiles, to_x + to_y * width, from_x + from_y * width);
+}
+
+static void undo_move_box(size_t from_x, size_t from_y, size_t to_x, size_t to_y, const struct matching_undo *undo) {
+	deadlock_remove(box_tiles, to_x + to_y * width);
+	deadlock_add(box_tiles, from_x + from_y * width);
+
+	if (use_matching) {
+		box_ids[from_y][from_x] = box_ids[to_y][to_x];
+		box_ids[to_y][to_x] = 0;
+		matching_undo_move(&matching, undo);
+	} else if (use_nearest) {
+		nearest_total += distances.nearest[from_x + from_y * width] - distances.nearest[to_x + to_y * width];
+	}
+}
 
-static void push_up(size_t x, size_t y, size_t depth, size_t top_left_index) {
+// Returns whether the box got pushed, in which case undo_push_up() has to be called afterwards
+static bool push_up(struct frame *f, size_t x, size_t y) {
 	// printf("In push_up() at (%zu,%zu)\n", x, y);
 
 	if (map[y][x] == BOX) {
@@ -156,14 +521,9 @@ static void push_up(size_t x, size_t y, size_t depth, size_t top_left_index) {
 			check_is_solved();
 		}
 
-		solve(x, y, depth+1, top_left_index);
-
-		path_length--;
-		if (map[y-1][x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y-1][x] = map[y-1][x] == BOX ? FLOOR : STORAGE;
-		map[y][x] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(x, y, x, y-1, &f->undo);
+		return true;
 	} else if (map[y][x] == STORED_BOX) {
 		// printf("In push_up(), STORED_BOX is seen\n");
 
@@ -175,19 +535,28 @@ static void push_up(size_t x, size_t y, size_t depth, size_t top_left_index) {
 			empty_storages--;
 		}
 
-		solve(x, y, depth+1, top_left_index);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(x, y, x, y-1, &f->undo);
+		return true;
+	}
+	return false;
+}
 
-		path_length--;
+static void undo_push_up(const struct frame *f, size_t x, size_t y) {
+	undo_move_box(x, y, x, y-1, &f->undo);
+
+	path_length--;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[y-1][x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y-1][x] = map[y-1][x] == BOX ? FLOOR : STORAGE;
-		map[y][x] = STORED_BOX;
 	}
+	if (map[y-1][x] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[y-1][x] = map[y-1][x] == BOX ? FLOOR : STORAGE;
+	map[y][x] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void push_down(size_t x, size_t y, size_t depth, size_t top_left_index) {
+static bool push_down(struct frame *f, size_t x, size_t y) {
 	// printf("In push_down() at (%zu,%zu)\n", x, y);
 
 	if (map[y][x] == BOX) {
@@ -201,14 +570,9 @@ static void push_down(size_t x, size_t y, size_t depth, size_t top_left_index) {
 			check_is_solved();
 		}
 
-		solve(x, y, depth+1, top_left_index);
-
-		path_length--;
-		if (map[y+1][x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y+1][x] = map[y+1][x] == BOX ? FLOOR : STORAGE;
-		map[y][x] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(x, y, x, y+1, &f->undo);
+		return true;
 	} else if (map[y][x] == STORED_BOX) {
 		// printf("In push_down(), STORED_BOX is seen\n");
 
@@ -220,19 +584,28 @@ static void push_down(size_t x, size_t y, size_t depth, size_t top_left_index) {
 			empty_storages--;
 		}
 
-		solve(x, y, depth+1, top_left_index);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(x, y, x, y+1, &f->undo);
+		return true;
+	}
+	return false;
+}
+
+static void undo_push_down(const struct frame *f, size_t x, size_t y) {
+	undo_move_box(x, y, x, y+1, &f->undo);
 
-		path_length--;
+	path_length--;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[y+1][x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y+1][x] = map[y+1][x] == BOX ? FLOOR : STORAGE;
-		map[y][x] = STORED_BOX;
 	}
+	if (map[y+1][x] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[y+1][x] = map[y+1][x] == BOX ? FLOOR : STORAGE;
+	map[y][x] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void push_left(size_t x, size_t y, size_t depth, size_t top_left_index) {
+static bool push_left(struct frame *f, size_t x, size_t y) {
 	// printf("In push_left() at (%zu,%zu)\n", x, y);
 
 	if (map[y][x] == BOX) {
@@ -246,14 +619,9 @@ static void push_left(size_t x, size_t y, size_t depth, size_t top_left_index) {
 			check_is_solved();
 		}
 
-		solve(x, y, depth+1, top_left_index);
-
-		path_length--;
-		if (map[y][x-1] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y][x-1] = map[y][x-1] == BOX ? FLOOR : STORAGE;
-		map[y][x] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(x, y, x-1, y, &f->undo);
+		return true;
 	} else if (map[y][x] == STORED_BOX) {
 		// printf("In push_left(), STORED_BOX is seen\n");
 
@@ -265,19 +633,28 @@ static void push_left(size_t x, size_t y, size_t depth, size_t top_left_index) {
 			empty_storages--;
 		}
 
-		solve(x, y, depth+1, top_left_index);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(x, y, x-1, y, &f->undo);
+		return true;
+	}
+	return false;
+}
 
-		path_length--;
+static void undo_push_left(const struct frame *f, size_t x, size_t y) {
+	undo_move_box(x, y, x-1, y, &f->undo);
+
+	path_length--;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[y][x-1] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y][x-1] = map[y][x-1] == BOX ? FLOOR : STORAGE;
-		map[y][x] = STORED_BOX;
 	}
+	if (map[y][x-1] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[y][x-1] = map[y][x-1] == BOX ? FLOOR : STORAGE;
+	map[y][x] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void push_right(size_t x, size_t y, size_t depth, size_t top_left_index) {
+static bool push_right(struct frame *f, size_t x, size_t y) {
 	// printf("In push_right() at (%zu,%zu)\n", x, y);
 
 	if (map[y][x] == BOX) {
@@ -291,14 +668,9 @@ static void push_right(size_t x, size_t y, size_t depth, size_t top_left_index)
 			check_is_solved();
 		}
 
-		solve(x, y, depth+1, top_left_index);
-
-		path_length--;
-		if (map[y][x+1] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y][x+1] = map[y][x+1] == BOX ? FLOOR : STORAGE;
-		map[y][x] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(x, y, x+1, y, &f->undo);
+		return true;
 	} else if (map[y][x] == STORED_BOX) {
 		// printf("In push_right(), STORED_BOX is seen\n");
 
@@ -310,98 +682,119 @@ static void push_right(size_t x, size_t y, size_t depth, size_t top_left_index)
 			empty_storages--;
 		}
 
-		solve(x, y, depth+1, top_left_index);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(x, y, x+1, y, &f->undo);
+		return true;
+	}
+	return false;
+}
+
+static void undo_push_right(const struct frame *f, size_t x, size_t y) {
+	undo_move_box(x, y, x+1, y, &f->undo);
 
-		path_length--;
+	path_length--;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[y][x+1] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[y][x+1] = map[y][x+1] == BOX ? FLOOR : STORAGE;
-		map[y][x] = STORED_BOX;
 	}
+	if (map[y][x+1] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[y][x+1] = map[y][x+1] == BOX ? FLOOR : STORAGE;
+	map[y][x] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void flood(size_t x, size_t y, bool reachable[MAX_HEIGHT][MAX_WIDTH], enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH]);
+// flood() used to recurse once per reachable tile, so it keeps its own stack of tiles to flood from instead
+static u16 flood_stack[MAX_HEIGHT * MAX_WIDTH];
+static size_t flood_stack_size;
+
+static void flood_visit(size_t x, size_t y, bool *reachable) {
+	if (!reachable[x + y * width]) {
+		reachable[x + y * width] = true;
+		flood_stack[flood_stack_size++] = x + y * width;
+	}
+}
 
-static void flood_up(size_t x, size_t y, bool reachable[MAX_HEIGHT][MAX_WIDTH], enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH]) {
+static void flood_up(size_t x, size_t y, bool *reachable, u8 *pushable) {
 	// printf("In flood_up() at (%zu,%zu)\n", x, y);
 
 	if (map[y-1][x] == FLOOR || map[y-1][x] == STORAGE) {
 		// printf("Flooding up\n");
-		flood(x, y-1, reachable, pushable);
+		flood_visit(x, y-1, reachable);
 	} else if ((map[y-1][x] == BOX || map[y-1][x] == STORED_BOX) && (map[y-2][x] == FLOOR || map[y-2][x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[y-2][x] == FLOOR && map[y-3][x] == WALL && (map[y-2][x-1] == WALL || map[y-2][x+1] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[y-2][x]) {
 			return;
 		}
 
 		// printf("Will be pushing box up\n");
-		pushable[y-1][x] |= pushing_up;
+		pushable[x + (y-1) * width] |= pushing_up;
 	}
 }
 
-static void flood_down(size_t x, size_t y, bool reachable[MAX_HEIGHT][MAX_WIDTH], enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH]) {
+static void flood_down(size_t x, size_t y, bool *reachable, u8 *pushable) {
 	// printf("In flood_down() at (%zu,%zu)\n", x, y);
 
 	if (map[y+1][x] == FLOOR || map[y+1][x] == STORAGE) {
 		// printf("Flooding down\n");
-		flood(x, y+1, reachable, pushable);
+		flood_visit(x, y+1, reachable);
 	} else if ((map[y+1][x] == BOX || map[y+1][x] == STORED_BOX) && (map[y+2][x] == FLOOR || map[y+2][x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[y+2][x] == FLOOR && map[y+3][x] == WALL && (map[y+2][x-1] == WALL || map[y+2][x+1] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[y+2][x]) {
 			return;
 		}
 
 		// printf("Will be pushing box down\n");
-		pushable[y+1][x] |= pushing_down;
+		pushable[x + (y+1) * width] |= pushing_down;
 	}
 }
 
-static void flood_left(size_t x, size_t y, bool reachable[MAX_HEIGHT][MAX_WIDTH], enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH]) {
+static void flood_left(size_t x, size_t y, bool *reachable, u8 *pushable) {
 	// printf("In flood_left() at (%zu,%zu)\n", x, y);
 
 	if (map[y][x-1] == FLOOR || map[y][x-1] == STORAGE) {
 		// printf("Flooding left\n");
-		flood(x-1, y, reachable, pushable);
+		flood_visit(x-1, y, reachable);
 	} else if ((map[y][x-1] == BOX || map[y][x-1] == STORED_BOX) && (map[y][x-2] == FLOOR || map[y][x-2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[y][x-2] == FLOOR && map[y][x-3] == WALL && (map[y-1][x-2] == WALL || map[y+1][x-2] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[y][x-2]) {
 			return;
 		}
 
 		// printf("Will be pushing box left\n");
-		pushable[y][x-1] |= pushing_left;
+		pushable[x-1 + y * width] |= pushing_left;
 	}
 }
 
-static void flood_right(size_t x, size_t y, bool reachable[MAX_HEIGHT][MAX_WIDTH], enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH]) {
+static void flood_right(size_t x, size_t y, bool *reachable, u8 *pushable) {
 	// printf("In flood_right() at (%zu,%zu)\n", x, y);
 
 	if (map[y][x+1] == FLOOR || map[y][x+1] == STORAGE) {
 		// printf("Flooding right\n");
-		flood(x+1, y, reachable, pushable);
+		flood_visit(x+1, y, reachable);
 	} else if ((map[y][x+1] == BOX || map[y][x+1] == STORED_BOX) && (map[y][x+2] == FLOOR || map[y][x+2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[y][x+2] == FLOOR && map[y][x+3] == WALL && (map[y-1][x+2] == WALL || map[y+1][x+2] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[y][x+2]) {
 			return;
 		}
 
 		// printf("Will be pushing box right\n");
-		pushable[y][x+1] |= pushing_right;
+		pushable[x+1 + y * width] |= pushing_right;
 	}
 }
 
-static void flood(size_t x, size_t y, bool reachable[MAX_HEIGHT][MAX_WIDTH], enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH]) {
-	if (reachable[y][x]) {
-		return;
-	}
-	reachable[y][x] = true;
+static void flood(size_t x, size_t y, bool *reachable, u8 *pushable) {
+	flood_visit(x, y, reachable);
 
-	flood_up(x, y, reachable, pushable);
-	flood_down(x, y, reachable, pushable);
-	flood_left(x, y, reachable, pushable);
-	flood_right(x, y, reachable, pushable);
+	while (flood_stack_size > 0) {
+		size_t tile = flood_stack[--flood_stack_size];
+		size_t tile_x = tile % width;
+		size_t tile_y = tile / width;
+
+		flood_up(tile_x, tile_y, reachable, pushable);
+		flood_down(tile_x, tile_y, reachable, pushable);
+		flood_left(tile_x, tile_y, reachable, pushable);
+		flood_right(tile_x, tile_y, reachable, pushable);
+	}
 }
 
 static void stringify_map(size_t top_left_index) {
@@ -424,6 +817,19 @@ static void stringify_map(size_t top_left_index) {
 	map_string[map_string_length] = '\0';
 }
 
+// Writes the map's key into map_string, which only looks at the floor tiles, unlike stringify_map()
+static void key_map(size_t top_left_index) {
+	static u16 box_floors[MAX_HEIGHT * MAX_WIDTH];
+	size_t boxes = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		box_floors[boxes] = i;
+		boxes += t == BOX || t == STORED_BOX; // Branchless, since whether a floor tile has a box is a coin flip
+	}
+	key_encode(&key_format, map_string, box_floors, boxes, floor_indices[top_left_index / width][top_left_index % width]);
+	map_string_length = key_format.length;
+}
+
 // From https://sourceware.org/git/?p=binutils-gdb.git;a=blob;f=bfd/elf.c#l193
 static u32 elf_hash(const char *namearg) {
 	u32 h = 0;
@@ -434,157 +840,1446 @@ static u32 elf_hash(const char *namearg) {
 	return h & 0x0fffffff;
 }
 
-static void solve(size_t x, size_t y, size_t depth, size_t parent_top_left_index) {
-	// printf("In solve() at (%zu,%zu)\n", x, y);
+static void use_tables(char *t) {
+	tables = t;
+	buckets = (u32 *)tables;
+	chains = (u32 *)(tables + PAGE_ALIGN(MAX_MAPS * sizeof(u32)));
+	map_budgets = (i32 *)((char *)chains + PAGE_ALIGN(MAX_MAPS * sizeof(u32)));
+	map_offsets = (u32 *)((char *)map_budgets + PAGE_ALIGN(MAX_MAPS * sizeof(i32)));
+	map_strings = (char *)map_offsets + PAGE_ALIGN(MAX_MAPS * sizeof(u32));
+}
 
-	current_solve_calls++;
-	total_solve_calls++;
+static void allocate_pushables(void) {
+	pushables = mmap(NULL, (MAX_PATH_LENGTH + 1) * width * height, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pushables == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+}
 
-	if (depth > max_depth) {
+static void allocate_tables(void) {
+	tables_size = PAGE_ALIGN(MAX_MAPS * sizeof(u32)) * 2 + PAGE_ALIGN(MAX_MAPS * sizeof(i32)) + PAGE_ALIGN(MAX_MAPS * sizeof(u32)) + PAGE_ALIGN(MAX_MAP_STRINGS_CHARS);
+
+	use_tables(pages_map(&pages, tables_size));
+
+	maps_size = 1;
+	map_strings_size = 0;
+}
+
+static bool write_all(int fd, const void *buf, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t written = pwrite(fd, buf, size, offset);
+		if (written < 0) {
+			return false;
+		}
+		buf = (const char *)buf + written;
+		size -= written;
+		offset += written;
+	}
+	return true;
+}
+
+// Pages of buckets that are still all zero are left as holes, so the file stays sparse
+static bool write_sparse(int fd, const char *buf, size_t size, off_t offset) {
+	static const char zero_page[PAGE_SIZE];
+	for (size_t i = 0; i < size; i += PAGE_SIZE) {
+		size_t n = size - i < PAGE_SIZE ? size - i : PAGE_SIZE;
+		if (memcmp(buf + i, zero_page, n) != 0 && !write_all(fd, buf + i, n, offset + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The maps on the current path haven't been fully searched yet,
+// so their budgets are rolled back while the tables are written
+static void swap_in_progress_budgets(size_t depth) {
+	for (size_t d = 1; d < depth; d++) {
+		i32 budget = map_budgets[in_progress[d].index];
+		map_budgets[in_progress[d].index] = in_progress[d].previous_budget;
+		in_progress[d].previous_budget = budget;
+	}
+}
+
+static void write_checkpoint(size_t depth) {
+	checkpoint_requested = 0;
+
+	struct checkpoint_header header = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.level_hash = level_hash,
+		.max_maps = MAX_MAPS,
+		.max_map_strings_chars = MAX_MAP_STRINGS_CHARS,
+		.max_depth = max_depth,
+		.current_solve_calls = current_solve_calls,
+		.total_solve_calls = total_solve_calls,
+		.maps_size = maps_size,
+		.map_strings_size = map_strings_size,
+		.ranked_maps = use_ranking ? rank_size(&ranking) : 0,
+	};
+
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", checkpoint_path);
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(tmp_path);
+		return;
+	}
+
+	swap_in_progress_budgets(depth);
+
+	bool ok = write_all(fd, &header, sizeof(header), 0)
+		&& write_sparse(fd, (char *)buckets, MAX_MAPS * sizeof(u32), PAGE_SIZE)
+		&& write_all(fd, chains, maps_size * sizeof(u32), PAGE_SIZE + ((char *)chains - tables))
+		&& write_sparse(fd, (char *)map_budgets, (use_ranking ? MAX_MAPS : maps_size) * sizeof(i32), PAGE_SIZE + ((char *)map_budgets - tables))
+		&& write_all(fd, map_offsets, maps_size * sizeof(u32), PAGE_SIZE + ((char *)map_offsets - tables))
+		&& write_all(fd, map_strings, map_strings_size, PAGE_SIZE + (map_strings - tables))
+		&& ftruncate(fd, PAGE_SIZE + tables_size) == 0
+		&& fsync(fd) == 0;
+
+	swap_in_progress_budgets(depth);
+
+	if (close(fd) != 0 || !ok || rename(tmp_path, checkpoint_path) != 0) {
+		perror(checkpoint_path);
+		unlink(tmp_path);
 		return;
 	}
 
-	// printf("parent_top_left_index: %zu\n", parent_top_left_index);
-	stringify_map(parent_top_left_index);
+	fprintf(stderr, "Wrote checkpoint '%s' at max_depth %zu with %zu memoized maps\n", checkpoint_path, max_depth, maps_size - 1);
+
+	if (exit_requested) {
+		exit(EXIT_FAILURE);
+	}
+	alarm(checkpoint_interval);
+}
+
+// The tables are mapped straight from the file, so resuming only pages in the parts that get probed
+static void load_checkpoint(void) {
+	int fd = open(checkpoint_path, O_RDONLY);
+	if (fd < 0) {
+		perror(checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+
+	struct checkpoint_header header;
+	struct stat st;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) != 0) {
+		fprintf(stderr, "Couldn't read checkpoint '%s'\n", checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+
+	tables_size = PAGE_ALIGN(MAX_MAPS * sizeof(u32)) * 2 + PAGE_ALIGN(MAX_MAPS * sizeof(i32)) + PAGE_ALIGN(MAX_MAPS * sizeof(u32)) + PAGE_ALIGN(MAX_MAP_STRINGS_CHARS);
+
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+	 || header.version != CHECKPOINT_VERSION
+	 || header.max_maps != MAX_MAPS
+	 || header.max_map_strings_chars != MAX_MAP_STRINGS_CHARS
+	 || header.ranked_maps != (use_ranking ? rank_size(&ranking) : 0)
+	 || (size_t)st.st_size != PAGE_SIZE + tables_size) {
+		fprintf(stderr, "'%s' isn't a checkpoint of this version of area.c\n", checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+	if (header.level_hash != level_hash) {
+		fprintf(stderr, "'%s' is a checkpoint of a different map\n", checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+
+	char *t = mmap(NULL, tables_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, PAGE_SIZE);
+	if (t == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	use_tables(t);
+
+	max_depth = header.max_depth;
+	current_solve_calls = header.current_solve_calls;
+	total_solve_calls = header.total_solve_calls;
+	maps_size = header.maps_size;
+	map_strings_size = header.map_strings_size;
+
+	fprintf(stderr, "Resuming '%s' at max_depth %zu with %zu memoized maps\n", checkpoint_path, max_depth, maps_size - 1);
+}
+
+static void handle_signal(int sig) {
+	checkpoint_requested = 1;
+	if (sig == SIGINT || sig == SIGTERM) {
+		exit_requested = 1;
+	}
+}
+
+static void install_signal_handlers(bool checkpointing) {
+	struct sigaction sa = {0};
+	sa.sa_handler = handle_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGUSR1, &sa, NULL);
+	if (checkpointing) {
+		sigaction(SIGALRM, &sa, NULL);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		alarm(checkpoint_interval);
+	}
+}
+
+static void memo_table_full(void) {
+	fprintf(stderr, "The memo table is full! You need to up the MAX_MAPS and MAX_MAP_STRINGS_CHARS #defines\n");
+	exit(EXIT_FAILURE);
+}
+
+// find_map() for when other workers add maps at the same time, without locks:
+// a new map is written out in full before it's published by swinging its bucket over to it,
+// and if another worker got a map into the bucket first, only the maps that are new since have to be checked again
+static u32 find_shared_map(u32 bucket_index) {
+	u32 i = __atomic_load_n(&buckets[bucket_index], __ATOMIC_ACQUIRE);
+	u32 checked = 0; // Where the part of the chain starts that's already checked
+	u32 added = 0;
+
+	while (true) {
+		for (u32 j = i; j != checked; j = chains[j]) {
+			if (strcmp(map_string, map_strings + map_offsets[j]) == 0) {
+				return j; // A map that was added for nothing is left unused
+			}
+		}
+
+		if (added == 0) {
+			added = __atomic_fetch_add(&lazy_smp->maps_size, 1, __ATOMIC_RELAXED);
+			size_t offset = __atomic_fetch_add(&lazy_smp->map_strings_size, map_string_length+1, __ATOMIC_RELAXED);
+			if (added >= MAX_MAPS || offset + map_string_length+1 > MAX_MAP_STRINGS_CHARS) {
+				memo_table_full();
+			}
+			map_offsets[added] = offset;
+			memcpy(map_strings + offset, map_string, map_string_length+1);
+			maps_size = added + 1;
+		}
+
+		checked = i;
+		chains[added] = i;
+		if (__atomic_compare_exchange_n(&buckets[bucket_index], &i, added, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			return added;
+		}
+	}
+}
+
+// Returns the index of the map in the memo table, adding it if it's new
+static u32 find_map(size_t top_left_index) {
+	key_map(top_left_index);
 	// printf("map_string:\n%s\n", map_string);
 
 	u32 bucket_index = elf_hash(map_string) % MAX_MAPS;
+	if (workers > 1) {
+		return find_shared_map(bucket_index);
+	}
 
 	u32 i = buckets[bucket_index];
 
 	while (true) {
-		if (i == UINT32_MAX) {
+		if (i == 0) {
+			if (maps_size == MAX_MAPS || map_strings_size + map_string_length+1 > MAX_MAP_STRINGS_CHARS) {
+				memo_table_full();
+			}
+
 			// printf("Memoizing map:\n%.*s\n", (int)map_string_length, map_string);
-			maps[maps_size] = map_strings + map_strings_size;
-			map_depths[maps_size] = depth;
+			map_offsets[maps_size] = map_strings_size;
+			map_budgets[maps_size] = 0;
 			memcpy(map_strings + map_strings_size, map_string, map_string_length+1);
 			map_strings_size += map_string_length+1;
 
 			// If this map hasn't been seen before, memoize it
 			chains[maps_size] = buckets[bucket_index];
-			buckets[bucket_index] = maps_size++;
-
-			break;
+			buckets[bucket_index] = maps_size;
+			return maps_size++;
 		}
 
-		if (strcmp(map_string, maps[i]) == 0) {
-			if (depth < map_depths[i]) {
-				map_depths[i] = depth;
-				break;
-			} else {
-				return; // Memoization, by stopping if the map_string has been seen before
-			}
+		if (strcmp(map_string, map_strings + map_offsets[i]) == 0) {
+			return i;
 		}
 
 		i = chains[i];
 	}
+}
 
-	// print_map();
-
-	static bool reachable[MAX_HEIGHT][MAX_WIDTH];
-	memset(reachable, false, sizeof(reachable));
-
-	enum push_direction pushable[MAX_HEIGHT][MAX_WIDTH];
-	memset(pushable, 0, sizeof(pushable));
-
-	flood(x, y, reachable, pushable);
-
-	size_t top_left_index = 0;
-	for (size_t py = 0; py < height; py++) {
-		for (size_t px = 0; px < width; px++) {
-			if (reachable[py][px]) {
-				top_left_index = px + py * width;
-				goto found_top_left;
+// The boxes are always on squares of the ranking, since init_ranking() only leaves out the dead tiles that no box starts out on, and boxes can't be pushed onto dead tiles
+static u32 rank_map(size_t top_left_index) {
+	u16 squares[RANK_MAX_BOXES];
+	size_t boxes = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] == BOX || map[y][x] == STORED_BOX) {
+				squares[boxes++] = box_squares[y][x];
 			}
 		}
 	}
-found_top_left:
 
-	for (size_t py = 0; py < height; py++) {
-		for (size_t px = 0; px < width; px++) {
-			enum push_direction d = pushable[py][px];
-			if (d != 0) {
-				if (d & pushing_up) {
-					// printf("Pushing box (%zu,%zu) up\n", px, py);
-					push_up(px, py, depth, top_left_index);
-					// printf("Reverting pushing box (%zu,%zu) up\n", px, py);
-				}
-				if (d & pushing_down) {
-					// printf("Pushing box (%zu,%zu) down\n", px, py);
-					push_down(px, py, depth, top_left_index);
-					// printf("Reverting pushing box (%zu,%zu) down\n", px, py);
-				}
-				if (d & pushing_left) {
-					// printf("Pushing box (%zu,%zu) left\n", px, py);
-					push_left(px, py, depth, top_left_index);
-					// printf("Reverting pushing box (%zu,%zu) left\n", px, py);
-				}
-				if (d & pushing_right) {
-					// printf("Pushing box (%zu,%zu) right\n", px, py);
-					push_right(px, py, depth, top_left_index);
-					// printf("Reverting pushing box (%zu,%zu) right\n", px, py);
-				}
-			}
-		}
-	}
+	u64 rank = rank_boxes(&ranking, squares) * player_squares_size + player_squares[top_left_index / width][top_left_index % width];
+	return rank + 1; // Index 0 is reserved
 }
 
-static void reset(void) {
-	maps_size = 0;
-	map_string_length = 0;
-	map_strings_size = 0;
-	current_solve_calls = 0;
-	memset(buckets, UINT32_MAX, sizeof(buckets));
+// xorshift64, like generator.c's
+static u64 next_random(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
 }
 
-int main(void) {
-	size_t player_x = 0;
-	size_t player_y = 0;
+// Every run of every worker gets its own stream, so any run can be replayed from the seed
+static void seed_random(size_t run) {
+	// splitmix64, since xorshift64 mustn't start at 0, and similar seeds should give unrelated streams
+	u64 z = seed + (worker + 1) * 0x9E3779B97F4A7C15ull + run * 0xD1B54A32D192ED03ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	rng = (z ^ (z >> 31)) | 1;
+}
 
-	size_t n = 1;
-	char *line = malloc(n);
-	while (getline(&line, &n, stdin) > 0) {
-		if (line[0] == '%' || isspace(line[0])) { // If this line is a comment or whitespace
-			continue;
+// No solution was found without ever running into the depth limit, so going deeper won't find one either
+static void finish_map(u32 index, bool cut_off, size_t pending_before, u64 discovery, size_t player) {
+	if (cut_off) {
+		while (pending_size > pending_before) {
+			pending_discoveries[pending[--pending_size]] = 0;
 		}
+		return;
+	}
 
-		size_t len = 0;
-		while (line[len] != '\n') {
-			char c = line[len];
-			if (c == '@' || c == '+') {
-				player_x = len;
-				player_y = height;
-				if (c == '+') {
-					empty_storages++;
-					map[height][len] = STORAGE;
-				}
-			} else {
-				enum tile t = char_to_tile(c);
-				if (t == STORAGE) {
-					empty_storages++;
-				}
-				map[height][len] = t;
-			}
-			len++;
-		}
-		width = len > width ? len : width;
-		height++;
+	if (shallowest_cycle < discovery) {
+		pending_discoveries[index] = discovery;
+		pending[pending_size++] = index;
+		return;
 	}
-	free(line);
-	printf("player_x: %zu\n", player_x);
-	printf("player_y: %zu\n", player_y);
+
+	map_budgets[index] = DEADLOCKED;
+	while (pending_size > pending_before) {
+		u32 p = pending[--pending_size];
+		pending_discoveries[p] = 0;
+		map_budgets[p] = DEADLOCKED;
+	}
+
+	if (use_deadlocks) {
+		deadlock_learn(&deadlocks, box_tiles, player);
+	}
+}
+
+// The memo table is kept across iterations: a map that was already searched
+// with at least as many pushes to spare can't lead to a solution this time either
+// Returns whether the pushes from this map should be searched, in which case leave() has to be called afterwards
+static bool enter(struct frame *f, size_t x, size_t y, size_t depth) {
+	// printf("In enter() at (%zu,%zu)\n", x, y);
+
+	current_solve_calls++;
+	total_solve_calls++;
+
+	if (anytime_node(&anytime)) {
+		hit_limit();
+	}
+
+	if (benchmarking && !bench_recording(&bench)) {
+		return false;
+	}
+
+	if (empty_storages < best_empty_storages) {
+		best_empty_storages = empty_storages;
+		memcpy(best_path, path, path_length * sizeof(path[0]));
+		best_path_length = path_length;
+	}
+
+	f->cutoffs_before = cutoffs;
+
+	if (depth > max_depth) {
+		cutoffs++;
+		return false;
+	}
+
+	// The matching is a lower bound on the pushes that are still needed
+	if (use_matching && (size_t)matching.total > max_depth - depth + 1) {
+		cutoffs += matching.total < MATCHING_UNREACHABLE;
+		return false;
+	}
+	if (use_nearest && nearest_total > max_depth - depth + 1) {
+		cutoffs++;
+		return false;
+	}
+
+	if (checkpoint_requested) {
+		write_checkpoint(depth);
+	}
+
+	static bool reachable[MAX_HEIGHT * MAX_WIDTH];
+	memset(reachable, false, width * height);
+
+	f->pushable = pushables + depth * width * height;
+	memset(f->pushable, 0, width * height);
+
+	flood(x, y, reachable, f->pushable);
+
+	size_t top_left_index = 0;
+	u32 index;
+	while (!reachable[top_left_index]) {
+		top_left_index++;
+	}
+
+	// The player's own area has to be part of the key, since the memo table outlives this iteration
+	// printf("top_left_index: %zu\n", top_left_index);
+	index = use_ranking ? rank_map(top_left_index) : find_map(top_left_index);
+
+	// A pending map didn't run into the depth limit, so searching it again with more pushes to spare is pointless
+	if (pending_discoveries[index] != 0) {
+		shallowest_cycle = pending_discoveries[index] < shallowest_cycle ? pending_discoveries[index] : shallowest_cycle;
+		return false;
+	}
+
+	i32 budget = max_depth - depth + 1;
+	i32 memo_budget = __atomic_load_n(&map_budgets[index], __ATOMIC_RELAXED); // Other workers write it too
+
+	// With --workers, a map that another worker is still searching is searched alongside it, in this worker's own order,
+	// so only this worker's own stack says whether the search went in a circle
+	if (workers > 1 && stack_depths[index] != 0) {
+		size_t ancestor = stack_depths[index];
+		shallowest_cycle = frames[ancestor].discovery < shallowest_cycle ? frames[ancestor].discovery : shallowest_cycle;
+		return false;
+	}
+
+	if (budget <= memo_budget) {
+		// A map that is still being searched higher up means the search went in a circle,
+		// which says nothing about the depth limit
+		size_t ancestor = max_depth + 1 - memo_budget;
+		if (memo_budget != DEADLOCKED && ancestor < depth && in_progress[ancestor].index == index) {
+			shallowest_cycle = frames[ancestor].discovery < shallowest_cycle ? frames[ancestor].discovery : shallowest_cycle;
+		} else {
+			cutoffs += memo_budget != DEADLOCKED;
+		}
+		return false; // Memoization, by stopping if the map has been searched at least this deep before
+	}
+
+	if (use_ranking && memo_budget == 0) {
+		maps_size++;
+	}
+	if (maps_size >= pages.next_promote) {
+		pages_promote(&pages, maps_size);
+	}
+	in_progress[depth] = (struct in_progress){.index=index, .previous_budget=memo_budget};
+	if (workers > 1) {
+		stack_depths[index] = depth;
+	} else {
+		map_budgets[index] = budget;
+	}
+
+	f->x = x;
+	f->y = y;
+	f->index = index;
+	f->budget = budget;
+	f->discovery = ++discoveries;
+	f->outer_cycle = shallowest_cycle;
+	shallowest_cycle = UINT64_MAX;
+	f->pending_before = pending_size;
+	f->first_tile = seeded ? next_random() % (width * height) : 0;
+	f->tile = f->first_tile;
+	f->order = seeded ? next_random() % 24 : worker % 24;
+	f->direction = 0;
+	f->moved = false;
+
+	size_t sample = benchmarking ? bench_slot(&bench) : SIZE_MAX;
+	if (sample != SIZE_MAX) {
+		struct bench_state *b = &bench_states[sample];
+		memcpy(b->map, map, height * sizeof(map[0]));
+		b->x = x;
+		b->y = y;
+		b->top_left_index = top_left_index;
+		b->empty_storages = empty_storages;
+	}
+	return true;
+}
+
+static void leave(const struct frame *f) {
+	finish_map(f->index, cutoffs != f->cutoffs_before, f->pending_before, f->discovery, f->x + f->y * width);
+
+	if (workers > 1) {
+		stack_depths[f->index] = 0;
+		// Another worker may have finished the map with more pushes to spare, or found it to be deadlocked
+		i32 memo_budget = __atomic_load_n(&map_budgets[f->index], __ATOMIC_RELAXED);
+		while (memo_budget < f->budget && !__atomic_compare_exchange_n(&map_budgets[f->index], &memo_budget, f->budget, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+	}
+
+	shallowest_cycle = shallowest_cycle < f->outer_cycle ? shallowest_cycle : f->outer_cycle;
+}
+
+static bool (*const pushes[4])(struct frame *f, size_t x, size_t y) = {push_up, push_down, push_left, push_right};
+static void (*const undo_pushes[4])(const struct frame *f, size_t x, size_t y) = {undo_push_up, undo_push_down, undo_push_left, undo_push_right};
+
+// Gives up on the current run of solve(), by undoing the pushes of the frames,
+// and giving the maps on the stack back the budgets they had, since their subtrees weren't searched in full
+// The budgets of the maps that were finished still hold, so the next run skips them
+static void restart(size_t depth) {
+	for (; depth > 0; depth--) {
+		struct frame *f = &frames[depth];
+		if (f->moved) {
+			size_t tile = f->tile < width * height ? f->tile : f->tile - width * height;
+			undo_pushes[push_orders[f->order][f->direction - 1]](f, tile % width, tile / width);
+			f->moved = false;
+		}
+		if (workers > 1) {
+			stack_depths[f->index] = 0;
+		} else {
+			map_budgets[f->index] = in_progress[depth].previous_budget;
+		}
+	}
+
+	while (pending_size > 0) {
+		pending_discoveries[pending[--pending_size]] = 0;
+	}
+	shallowest_cycle = UINT64_MAX;
+	restarts++;
+}
+
+// The i-th number of the Luby sequence 1, 1, 2, 1, 1, 2, 4, 1, 1, 2, 1, 1, 2, 4, 8, ..., from i = 0
+// See "Optimal Speedup of Las Vegas Algorithms" by Luby, Sinclair and Zuckerman
+static u64 luby(u64 i) {
+	u64 size = 1;
+	u64 exponent = 0;
+	while (size < i + 1) {
+		size = 2 * size + 1;
+		exponent++;
+	}
+	while (size - 1 != i) {
+		size = (size - 1) / 2;
+		exponent--;
+		i %= size;
+	}
+	return (u64)1 << exponent;
+}
+
+// A depth-first search that keeps its frames in an array instead of on the C stack,
+// so max_depth is only limited by MAX_PATH_LENGTH, and the whole search state can be inspected at any point
+// The pushes of a map are tried tile by tile, from its first_tile on, in the order of its push_orders
+// Returns whether max_depth was searched in full, which is only not the case when --restarts gave up on it
+static bool solve(size_t x, size_t y) {
+	if (seeded) {
+		seed_random(runs);
+	}
+	if (restart_unit > 0) {
+		run_end = current_solve_calls + luby(runs) * restart_unit;
+	}
+	runs++;
+
+	size_t depth = 1;
+	if (!enter(&frames[depth], x, y, depth)) {
+		return true;
+	}
+
+	size_t tiles = width * height;
+	while (depth > 0) {
+		struct frame *f = &frames[depth];
+		size_t tile = f->tile < tiles ? f->tile : f->tile - tiles;
+		size_t px = tile % width;
+		size_t py = tile / width;
+
+		if (f->moved) {
+			undo_pushes[push_orders[f->order][f->direction - 1]](f, px, py);
+			f->moved = false;
+
+			if (__atomic_load_n(&lazy_smp->winner, __ATOMIC_RELAXED) != 0) {
+				stop_searching();
+			}
+		}
+
+		if (f->tile == f->first_tile + tiles) {
+			leave(f);
+			depth--;
+			continue;
+		}
+
+		if ((f->pushable[tile] & later_pushes[f->order][f->direction]) == 0) {
+			f->direction = 0;
+			f->tile++;
+			continue;
+		}
+
+		u8 direction = push_orders[f->order][f->direction++];
+		if (!(f->pushable[tile] & (1 << direction))) {
+			continue;
+		}
+
+		f->moved = pushes[direction](f, px, py);
+		if (f->moved && !f->deadlocked && enter(&frames[depth + 1], px, py, depth + 1)) {
+			depth++;
+			if (restart_unit > 0 && current_solve_calls >= run_end) {
+				restart(depth);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Puts the boxes and the player where they are in the map at the memo index, and walks back its path
+// Returns the player's tile
+static size_t load_map(u32 index) {
+	static bool has_box[MAX_HEIGHT * MAX_WIDTH];
+	size_t player = key_decode(&key_format, map_strings + map_offsets[index], has_box);
+
+	empty_storages = 0;
+	memset(box_tiles, 0, sizeof(box_tiles));
+	matching.cols = 0;
+	nearest_total = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		size_t x = floor_x[i];
+		size_t y = floor_y[i];
+		bool storage = map[y][x] == STORAGE || map[y][x] == STORED_BOX;
+		map[y][x] = has_box[i] ? (storage ? STORED_BOX : BOX) : (storage ? STORAGE : FLOOR);
+		empty_storages += storage && !has_box[i];
+		box_ids[y][x] = 0;
+		if (has_box[i]) {
+			deadlock_add(box_tiles, x + y * width);
+			nearest_total += distances.nearest[x + y * width];
+			if (use_matching) {
+				box_ids[y][x] = ++matching.cols;
+				for (size_t r = 0; r < matching.rows; r++) {
+					matching.cost[r + 1][matching.cols] = push_cost(x + y * width, r);
+				}
+			}
+		}
+	}
+	if (use_matching) {
+		matching_solve(&matching);
+	}
+
+	path_length = 0;
+	for (u32 i = index; parents[i] != 0; i = parents[i]) {
+		path_length++;
+	}
+	size_t length = path_length;
+	for (u32 i = index; parents[i] != 0; i = parents[i]) {
+		u32 p = parent_pushes[i];
+		path[--length] = (struct move){.x=p / 4 % width, .y=p / 4 / width, .direction=1 << p % 4};
+	}
+	max_depth = path_length + 1;
+
+	return floor_y[player] * width + floor_x[player];
+}
+
+// Fewer pushes that are still needed first, by the cheapest matching of boxes to storages, or else by every box's nearest storage,
+// then fewer empty storages, and then more room for the player
+static u64 score_map(size_t area) {
+	u64 matched = use_matching ? (u64)matching.total : use_nearest ? nearest_total : 0;
+	return matched << 32 | (u64)empty_storages << 16 | (floors_size - area);
+}
+
+// Tries every push from the map at the memo index, and hands every map it leads to that wasn't seen yet to add()
+// Pushes that solve the level are printed by check_is_solved() right away
+static void expand(u32 index, void (*add)(u64 score, u32 child)) {
+	static bool reachable[MAX_HEIGHT * MAX_WIDTH];
+	static u8 pushable[MAX_HEIGHT * MAX_WIDTH];
+	static bool child_reachable[MAX_HEIGHT * MAX_WIDTH];
+	static u8 child_pushable[MAX_HEIGHT * MAX_WIDTH];
+
+	current_solve_calls++;
+	total_solve_calls++;
+	if (anytime_node(&anytime)) {
+		print_result("limit");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t player = load_map(index);
+	if (empty_storages < best_empty_storages) {
+		best_empty_storages = empty_storages;
+		memcpy(best_path, path, path_length * sizeof(path[0]));
+		best_path_length = path_length;
+	}
+
+	memset(reachable, false, width * height);
+	memset(pushable, 0, width * height);
+	flood(player % width, player / width, reachable, pushable);
+
+	struct frame f;
+	for (size_t tile = 0; tile < width * height; tile++) {
+		for (u8 direction = 0; direction < 4; direction++) {
+			size_t x = tile % width;
+			size_t y = tile / width;
+			if (!(pushable[tile] & (1 << direction)) || !pushes[direction](&f, x, y)) {
+				continue;
+			}
+
+			if (!f.deadlocked && !(use_matching && matching.total >= MATCHING_UNREACHABLE)) {
+				// The player ends up where the box was
+				memset(child_reachable, false, width * height);
+				memset(child_pushable, 0, width * height);
+				flood(x, y, child_reachable, child_pushable);
+
+				size_t top_left_index = 0;
+				size_t area = 0;
+				for (size_t t = width * height; t-- > 0;) {
+					if (child_reachable[t]) {
+						top_left_index = t;
+						area++;
+					}
+				}
+
+				u32 child = find_map(top_left_index);
+				if (map_budgets[child] == 0) {
+					map_budgets[child] = 1;
+					parents[child] = index;
+					parent_pushes[child] = tile * 4 + direction;
+					add(score_map(area), child);
+				}
+			}
+
+			undo_pushes[direction](&f, x, y);
+		}
+	}
+}
+
+static int compare_scored(const void *a, const void *b) {
+	const struct scored *x = a;
+	const struct scored *y = b;
+	if (x->score != y->score) {
+		return x->score < y->score ? -1 : 1;
+	}
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// The open list of --greedy is a binary min-heap, and the beam of --beam is just every map the current beam led to
+static struct scored *open_maps;
+static size_t open_size;
+static size_t open_capacity;
+
+static bool scored_before(const struct scored *a, const struct scored *b) {
+	return compare_scored(a, b) < 0;
+}
+
+static void grow_open_maps(void) {
+	size_t limit = open_memory / sizeof(struct scored);
+	if (greedy && limit > 0 && open_size == limit) {
+		// The worse half of a sorted array is dropped, and what's left is still a heap
+		qsort(open_maps, open_size, sizeof(struct scored), compare_scored);
+		dropped += open_size - open_size / 2;
+		open_size /= 2;
+		return;
+	}
+
+	open_capacity = open_capacity == 0 ? 1024 : 2 * open_capacity;
+	if (greedy && limit > 0 && open_capacity > limit) {
+		open_capacity = limit;
+	}
+	open_maps = realloc(open_maps, open_capacity * sizeof(struct scored));
+	if (!open_maps) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void push_open(u64 score, u32 index) {
+	if (open_size == open_capacity) {
+		grow_open_maps();
+	}
+	size_t i = open_size++;
+	open_maps[i] = (struct scored){.score=score, .index=index};
+	if (!greedy) {
+		return;
+	}
+
+	while (i > 0 && scored_before(&open_maps[i], &open_maps[(i - 1) / 2])) {
+		struct scored t = open_maps[i];
+		open_maps[i] = open_maps[(i - 1) / 2];
+		open_maps[(i - 1) / 2] = t;
+		i = (i - 1) / 2;
+	}
+}
+
+static u32 pop_open(void) {
+	u32 index = open_maps[0].index;
+	open_maps[0] = open_maps[--open_size];
+	size_t i = 0;
+	while (true) {
+		size_t best = i;
+		for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < open_size; child++) {
+			if (scored_before(&open_maps[child], &open_maps[best])) {
+				best = child;
+			}
+		}
+		if (best == i) {
+			return index;
+		}
+		struct scored t = open_maps[i];
+		open_maps[i] = open_maps[best];
+		open_maps[best] = t;
+		i = best;
+	}
+}
+
+// Greedy best-first search goes on from the best map that was seen so far but not searched yet,
+// while beam search only keeps the beam_width best maps of every depth, and forgets the rest,
+// so that they can still be pushed to from later on. Neither finds the shortest solution, but both find one much sooner
+static void search_by_score(size_t player_x, size_t player_y) {
+	static bool reachable[MAX_HEIGHT * MAX_WIDTH];
+	static u8 pushable[MAX_HEIGHT * MAX_WIDTH];
+	parents = pages_map(&pages, MAX_MAPS * sizeof(u32));
+	parent_pushes = pages_map(&pages, MAX_MAPS * sizeof(u32));
+
+	flood(player_x, player_y, reachable, pushable);
+	size_t top_left_index = 0;
+	while (!reachable[top_left_index]) {
+		top_left_index++;
+	}
+	u32 start = find_map(top_left_index);
+	map_budgets[start] = 1;
+
+	if (greedy) {
+		push_open(0, start);
+		while (open_size > 0) {
+			expand(pop_open(), push_open);
+		}
+	} else {
+		u32 *beam = malloc(beam_width * sizeof(u32));
+		size_t beam_size = 1;
+		beam[0] = start;
+		for (size_t depth = 1; beam_size > 0; depth++) {
+			open_size = 0;
+			for (size_t i = 0; i < beam_size; i++) {
+				expand(beam[i], push_open);
+			}
+
+			qsort(open_maps, open_size, sizeof(struct scored), compare_scored);
+			beam_size = open_size < beam_width ? open_size : beam_width;
+			for (size_t i = 0; i < open_size; i++) {
+				if (i < beam_size) {
+					beam[i] = open_maps[i].index;
+				} else {
+					map_budgets[open_maps[i].index] = 0;
+				}
+			}
+			printf("beam: kept %zu of the %zu new maps at depth %zu\n", beam_size, open_size, depth);
+			dropped += open_size - beam_size;
+		}
+		free(beam);
+	}
+
+	// Only running out of maps without ever dropping one proves there's no solution
+	printf("No solution was found :(\n");
+	if (dropped > 0) {
+		anytime.limit = greedy ? "open-memory" : "beam-width";
+		print_result("limit");
+	} else {
+		print_result("unsolved");
+	}
+	exit(EXIT_FAILURE);
+}
+
+static bool is_wall(size_t x, size_t y) {
+	return x >= width || y >= height || map[y][x] == WALL; // x-1 and y-1 wrap around when they go below 0
+}
+
+static size_t count_tiles(bool (*counts)(enum tile)) {
+	size_t count = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			count += counts(map[y][x]);
+		}
+	}
+	return count;
+}
+
+static bool is_box(enum tile t) {
+	return t == BOX || t == STORED_BOX;
+}
+
+static void preprocess(size_t *player_x, size_t *player_y) {
+	struct preprocess p = {.map=map, .frozen=frozen, .width=width, .height=height, .player_x=*player_x, .player_y=*player_y};
+	preprocess_level(&p);
+	width = p.width;
+	height = p.height;
+	*player_x = p.player_x;
+	*player_y = p.player_y;
+	origin_x = p.origin_x;
+	origin_y = p.origin_y;
+}
+
+// Numbers the floor tiles that are left after preprocessing, and picks the shortest key for the level
+static void init_keys(void) {
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] != WALL) {
+				floor_indices[y][x] = floors_size;
+				floor_x[floors_size] = x;
+				floor_y[floors_size] = y;
+				floors_size++;
+			}
+		}
+	}
+	key_init(&key_format, floors_size, count_tiles(is_box));
+}
+
+// The push distances, and the tiles that are dead, see preprocess.h
+static void init_distances(void) {
+	struct preprocess p = {.map=map, .frozen=frozen, .width=width, .height=height};
+	bool stuck;
+	use_nearest = preprocess_dead_tiles(&p, &distances, dead_tiles, &stuck);
+	if (stuck) {
+		fprintf(stderr, "A box is on a tile that no storage can be reached from, so no solution exists :(\n");
+		print_result("unsolved");
+		exit(EXIT_FAILURE);
+	}
+
+	nearest_total = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (is_box(map[y][x])) {
+				nearest_total += distances.nearest[x + y * width];
+			}
+		}
+	}
+}
+
+static void init_matching(void) {
+	size_t storages = 0;
+	size_t boxes = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			storages += map[y][x] == STORAGE || map[y][x] == STORED_BOX;
+			boxes += map[y][x] == BOX || map[y][x] == STORED_BOX;
+		}
+	}
+	if (storages == 0 || storages > boxes || boxes > MATCHING_MAX) {
+		printf("matching lower bound: disabled for %zu storages and %zu boxes\n\n", storages, boxes);
+		return;
+	}
+
+	matching.rows = storages;
+	matching.cols = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] == BOX || map[y][x] == STORED_BOX) {
+				box_ids[y][x] = ++matching.cols;
+				for (size_t i = 0; i < matching.rows; i++) {
+					matching.cost[i + 1][matching.cols] = push_cost(x + y * width, i);
+				}
+			}
+		}
+	}
+
+	matching_solve(&matching);
+	use_matching = true;
+	use_nearest = false;
+
+	printf("matching lower bound: %d pushes\n\n", matching.total);
+
+	if (matching.total >= MATCHING_UNREACHABLE) {
+		fprintf(stderr, "The boxes can't all be pushed onto a storage, so no solution exists :(\n");
+		print_result("unsolved");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Ranks the boxes over the tiles they can be on, and the player over every floor tile
+static void init_ranking(void) {
+	size_t box_squares_size = 0;
+	player_squares_size = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			box_squares[y][x] = NO_SQUARE;
+			player_squares[y][x] = NO_SQUARE;
+			if (is_wall(x, y)) {
+				continue;
+			}
+			player_squares[y][x] = player_squares_size++;
+
+			// Boxes can't be pushed onto dead tiles, so only the boxes that start out on one need a square there
+			if (!dead_tiles[y][x] || is_box(map[y][x])) {
+				box_squares[y][x] = box_squares_size++;
+			}
+		}
+	}
+
+	rank_init(&ranking, box_squares_size, count_tiles(is_box));
+	u64 maps = rank_multiply(rank_size(&ranking), player_squares_size);
+
+	use_ranking = maps < MAX_MAPS;
+	if (use_ranking) {
+		printf("ranking: %llu maps fit in the memo table, so they are ranked instead of hashed\n\n", (unsigned long long)maps);
+	} else {
+		printf("ranking: disabled, since there are more maps than MAX_MAPS\n\n");
+	}
+}
+
+static void save_deadlocks(void) {
+	// Every worker learns its own patterns, and the first one's are as good as any
+	if (worker == 0 && !deadlock_save(&deadlocks, deadlocks_path, level_hash)) {
+		perror(deadlocks_path);
+	}
+}
+
+static void init_deadlocks(void) {
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] == BOX || map[y][x] == STORED_BOX) {
+				deadlock_add(box_tiles, x + y * width);
+			}
+		}
+	}
+
+	// Removing boxes only makes a map easier when every box has to end up on a storage
+	if (!use_matching || matching.rows != matching.cols) {
+		printf("deadlock learning: disabled, since not every box has a storage\n\n");
+		return;
+	}
+
+	u64 walls[DEADLOCK_WORDS] = {0};
+	u64 storages[DEADLOCK_WORDS] = {0};
+	u64 dead[DEADLOCK_WORDS] = {0};
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			size_t tile = x + y * width;
+			if (is_wall(x, y)) {
+				deadlock_add(walls, tile);
+				continue;
+			}
+			if (map[y][x] == STORAGE || map[y][x] == STORED_BOX) {
+				deadlock_add(storages, tile);
+			}
+
+			if (distances_dead(&distances, tile)) {
+				deadlock_add(dead, tile);
+			}
+		}
+	}
+
+	// Tiles are numbered with the cropped width, so that a small map only needs a few words per set of tiles
+	deadlock_init(&deadlocks, width, width * height, walls, storages, dead);
+	use_deadlocks = true;
+
+	if (deadlocks_path) {
+		enum deadlock_file loaded = deadlock_load(&deadlocks, deadlocks_path, level_hash);
+		if (loaded == DEADLOCK_FILE_LOADED) {
+			printf("deadlock learning: loaded %zu patterns from '%s'\n\n", deadlocks.patterns_size, deadlocks_path);
+		}
+		if (loaded == DEADLOCK_FILE_OTHER) {
+			// The file may well be another level's, or another solver's, which it's not up to this run to overwrite
+			fprintf(stderr, "'%s' isn't a deadlock file of this level, so it's left as it is\n", deadlocks_path);
+		} else {
+			atexit(save_deadlocks);
+		}
+	}
+}
+
+static void bench_load(size_t sample) {
+	const struct bench_state *b = &bench_states[sample];
+	memcpy(map, b->map, height * sizeof(map[0]));
+	empty_storages = b->empty_storages;
+	path_length = 0;
+}
+
+static void bench_load_key(size_t sample) {
+	bench_load(sample);
+	key_map(bench_states[sample].top_left_index);
+}
+
+static bool bench_reachable[MAX_HEIGHT * MAX_WIDTH];
+static u8 bench_pushable[MAX_HEIGHT * MAX_WIDTH];
+static struct frame bench_frame = {.pushable=bench_pushable};
+
+static void bench_flood(size_t sample) {
+	memset(bench_reachable, false, width * height);
+	memset(bench_frame.pushable, 0, width * height);
+	flood(bench_states[sample].x, bench_states[sample].y, bench_reachable, bench_frame.pushable);
+}
+
+static void bench_load_flood(size_t sample) {
+	bench_load(sample);
+	bench_flood(sample);
+}
+
+static void bench_key_map(size_t sample) {
+	key_map(bench_states[sample].top_left_index);
+}
+
+static volatile u32 bench_hash_sink;
+
+static void bench_elf_hash(size_t sample) {
+	(void)sample;
+	bench_hash_sink = elf_hash(map_string);
+}
+
+static void bench_find_map(size_t sample) {
+	bench_hash_sink = find_map(bench_states[sample].top_left_index);
+}
+
+static void bench_pushes(size_t sample) {
+	(void)sample;
+	struct frame *f = &bench_frame;
+	for (size_t py = 0; py < height; py++) {
+		for (size_t px = 0; px < width; px++) {
+			for (u8 direction = 0; direction < 4; direction++) {
+				if ((f->pushable[px + py * width] & (1 << direction)) && pushes[direction](f, px, py)) {
+					undo_pushes[direction](f, px, py);
+				}
+			}
+		}
+	}
+}
+
+// Records maps from the first BENCH_RECORD_NODES maps the search visits, and benchmarks the kernels on them
+static void run_benchmarks(size_t player_x, size_t player_y) {
+	for (max_depth = 1; max_depth < MAX_PATH_LENGTH; max_depth++) {
+		solve(player_x, player_y);
+		if (!bench_recording(&bench) || map_budgets[frames[1].index] == DEADLOCKED) {
+			break;
+		}
+	}
+	printf("bench: recorded %zu out of %zu searched maps, up to max_depth %zu\n", bench.samples, bench.seen, max_depth);
+
+	// The matching and the box tiles can't follow the recorded maps being swapped in
+	use_matching = false;
+	use_nearest = false;
+	use_deadlocks = false;
+
+	bench_run(&bench, "key_map()", bench_load, bench_key_map);
+	bench_run(&bench, "elf_hash()", bench_load_key, bench_elf_hash);
+	bench_run(&bench, "find_map()", bench_load, bench_find_map);
+	bench_run(&bench, "flood()", bench_load, bench_flood);
+	bench_run(&bench, "every push_*() + undo", bench_load_flood, bench_pushes);
+}
+
+// Replays a cached solution onto the map, so that a hit prints the solved map like a search would
+// The player is assumed to be able to walk around to every push, which the cache only records the boxes of
+// Returns false and leaves the map alone when the pushes don't solve the level
+static bool replay_cached_path(size_t player_x, size_t player_y) {
+	static enum tile replayed[MAX_HEIGHT][MAX_WIDTH];
+	memcpy(replayed, map, sizeof(map));
+	struct preprocess p = {.map=replayed, .frozen=frozen, .width=width, .height=height, .player_x=player_x, .player_y=player_y};
+	for (size_t i = 0; i < path_length; i++) {
+		struct move m = path[i];
+		int dx = m.direction == pushing_left ? -1 : m.direction == pushing_right;
+		int dy = m.direction == pushing_up ? -1 : m.direction == pushing_down;
+		p.player_x = m.x - dx;
+		p.player_y = m.y - dy;
+		if (preprocess_is_wall(&p, p.player_x, p.player_y) || preprocess_is_box(replayed[p.player_y][p.player_x]) || !preprocess_replay_move(&p, dx, dy, true)) {
+			return false;
+		}
+	}
+	if (preprocess_empty_storages(&p) > 0) {
+		return false;
+	}
+	memcpy(map, replayed, sizeof(map));
+	empty_storages = 0;
+	return true;
+}
+
+// Looks the level up in the cache, and exits with its result if it's there
+static void use_cached_result(size_t player_x, size_t player_y) {
+	if (!cache.path) {
+		return;
+	}
+
+	stringify_map(player_x + player_y * width);
+	cache.key = cache_hash(map_string);
+
+	char *cached_path;
+	const char *status = cache_lookup(&cache, &cached_path);
+	if (!status) {
+		return;
+	}
+	char direction;
+	size_t x;
+	size_t y;
+	int n;
+	const char *p = cached_path;
+	for (; path_length < MAX_PATH_LENGTH && sscanf(p, " %c%zu,%zu%n", &direction, &x, &y, &n) == 3 && strchr("UDLR", direction); p += n) {
+		path[path_length++] = (struct move){.x=x, .y=y, .direction=
+			direction == 'U' ? pushing_up :
+			direction == 'D' ? pushing_down :
+			direction == 'L' ? pushing_left : pushing_right};
+	}
+	// An entry that was cut off, mangled, or doesn't solve the level is treated as a miss, rather than as a shorter solution
+	bool malformed = p[strspn(p, " ")] != '\0' || (strcmp(status, "solved") == 0 && !replay_cached_path(player_x, player_y));
+	free(cached_path);
+	if (malformed) {
+		printf("cache: ignoring the level's path in '%s', which is malformed or doesn't solve it\n", cache.path);
+		path_length = 0;
+		return;
+	}
+	printf("cache: found the level in '%s'\n", cache.path);
+	from_cache = true;
+	max_depth = path_length;
+
+	if (strcmp(status, "solved") == 0) {
+		printf("Solved!\n");
+		print_map();
+		print_result("solved");
+		exit(EXIT_SUCCESS);
+	}
+	printf("No solution was found :(\n");
+	print_result("unsolved");
+	exit(EXIT_FAILURE);
+}
+
+// Fills push_orders with the permutations of the directions, in lexicographic order
+static void init_push_orders(void) {
+	for (size_t permutation = 0; permutation < 24; permutation++) {
+		u8 directions[4] = {0, 1, 2, 3};
+		size_t rest = permutation;
+		size_t factorials[4] = {6, 2, 1, 1};
+		for (size_t i = 0; i < 4; i++) {
+			size_t pick = rest / factorials[i];
+			rest %= factorials[i];
+			push_orders[permutation][i] = directions[pick];
+			memmove(directions + pick, directions + pick + 1, 3 - i - pick);
+		}
+		later_pushes[permutation][4] = 0;
+		for (size_t i = 4; i-- > 0;) {
+			later_pushes[permutation][i] = later_pushes[permutation][i + 1] | 1 << push_orders[permutation][i];
+		}
+	}
+}
+
+// Forks the other workers, which only stop once a worker found a solution or hit a limit, or the start turned out to be deadlocked
+// Every worker gets an even share of --max-nodes, and the other limits as they are
+static void start_workers(void) {
+	lazy_smp->maps_size = maps_size;
+	lazy_smp->map_strings_size = map_strings_size;
+	anytime.max_nodes = (anytime.max_nodes + workers - 1) / workers;
+	fflush(stdout);
+
+	for (size_t i = 1; i < workers; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			// Don't leave workers running when the first one gets killed, or hits a limit
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			worker = i;
+			perf.enabled = false;
+			return;
+		}
+	}
+}
+
+// Waits until every worker finished searching max_depth, since a worker that's already a push deeper
+// could otherwise find a longer solution before the others find the shortest one
+static void wait_for_workers(void) {
+	__atomic_add_fetch(&lazy_smp->searched, current_solve_calls, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&lazy_smp->finished, 1, __ATOMIC_ACQ_REL);
+	while (__atomic_load_n(&lazy_smp->finished, __ATOMIC_ACQUIRE) < max_depth * workers) {
+		if (__atomic_load_n(&lazy_smp->winner, __ATOMIC_RELAXED) != 0) {
+			stop_searching();
+		}
+		usleep(100);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	bool resume = false;
+	bool checkpointing = false;
+	size_t level_number = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--resume") == 0) {
+			resume = true;
+		} else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+			checkpoint_path = argv[++i];
+			checkpointing = true;
+		} else if (strcmp(argv[i], "--deadlocks") == 0 && i + 1 < argc) {
+			deadlocks_path = argv[++i];
+		} else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc) {
+			checkpoint_interval = strtoul(argv[++i], NULL, 10);
+			checkpointing = true;
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			benchmarking = true;
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			perf_open(&perf);
+		} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			cache.path = argv[++i];
+		} else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+			level_number = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			workers = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+			seeded = true;
+		} else if (strcmp(argv[i], "--restarts") == 0 && i + 1 < argc) {
+			restart_unit = strtoull(argv[++i], NULL, 10);
+			seeded = true;
+		} else if (strcmp(argv[i], "--greedy") == 0) {
+			greedy = true;
+		} else if (strcmp(argv[i], "--beam") == 0 && i + 1 < argc) {
+			beam_width = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--open-memory") == 0 && i + 1 < argc) {
+			open_memory = strtoull(argv[++i], NULL, 10) << 20;
+		} else if (!anytime_parse(&anytime, argc, argv, &i)) {
+			fprintf(stderr, "Usage: %s [--checkpoint path] [--checkpoint-interval seconds] [--resume] [--deadlocks path] [--max-nodes n] [--timeout seconds] [--max-memory MiB] [--level n] [--cache path] [--workers n] [--seed n] [--restarts maps] [--greedy [--open-memory MiB] | --beam width] [--perf] [--bench] < levels.txt\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (workers == 0 || (workers > 1 && (resume || checkpointing || benchmarking))) {
+		fprintf(stderr, "--workers has to be at least 1, and can't be combined with checkpoints or --bench\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((greedy || beam_width > 0) && (greedy == (beam_width > 0) || workers > 1 || seeded || resume || checkpointing || benchmarking)) {
+		fprintf(stderr, "Only one of --greedy and --beam can be passed, and neither can be combined with --workers, --seed, --restarts, checkpoints or --bench\n");
+		exit(EXIT_FAILURE);
+	}
+	if (greedy) {
+		snprintf(cache.variant, sizeof(cache.variant), "area-greedy");
+	} else if (beam_width > 0) {
+		snprintf(cache.variant, sizeof(cache.variant), "area-beam-%zu", beam_width);
+	}
+
+	if (restart_unit > 0 && benchmarking) {
+		fprintf(stderr, "--restarts can't be combined with --bench\n");
+		exit(EXIT_FAILURE);
+	}
+	init_push_orders();
+
+	lazy_smp = mmap(NULL, sizeof(*lazy_smp), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (lazy_smp == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t player_x = 0;
+	size_t player_y = 0;
+
+	perf_begin(&perf, 0);
+
+	struct levels collection;
+	if (!levels_open(&collection, STDIN_FILENO) || level_number == 0 || level_number > collection.levels_size) {
+		fprintf(stderr, "--level has to be between 1 and the %zu levels of the input\n", collection.levels_size);
+		exit(EXIT_FAILURE);
+	}
+	levels_print(&collection, level_number);
+	const struct level *level = &collection.levels[level_number - 1];
+	const char *cursor = level->start;
+	char row[MAX_WIDTH];
+	size_t len;
+	while (level_next_row(level, &cursor, row, MAX_WIDTH, &len)) {
+		for (size_t x = 0; x < len && x < MAX_WIDTH && height < MAX_HEIGHT; x++) {
+			char c = row[x];
+			if (c == '@' || c == '+') {
+				player_x = x;
+				player_y = height;
+				if (c == '+') {
+					empty_storages++;
+					map[height][x] = STORAGE;
+				}
+			} else {
+				enum tile t = char_to_tile(c);
+				if (t == STORAGE) {
+					empty_storages++;
+				}
+				map[height][x] = t;
+			}
+		}
+		width = len > width ? len : width;
+		height++;
+	}
+	levels_close(&collection);
+	printf("player_x: %zu\n", player_x);
+	printf("player_y: %zu\n", player_y);
+
+	anytime_start(&anytime);
+
+	if (width > MAX_WIDTH || height > MAX_HEIGHT) {
+		fprintf(stderr, "The map exceeds %s\n", width > MAX_WIDTH ? "MAX_WIDTH" : "MAX_HEIGHT");
+		print_result("error");
+		exit(EXIT_FAILURE);
+	}
+
+	preprocess(&player_x, &player_y);
+	init_keys();
+	best_empty_storages = empty_storages;
+
+	use_cached_result(player_x, player_y);
 
 	check_is_solved();
 
+	init_distances();
+	init_matching();
+	init_ranking();
+	if (benchmarking && use_ranking) {
+		use_ranking = false;
+		printf("bench: ranking is turned off, so that find_map() can be benchmarked\n\n");
+	}
+	if ((greedy || beam_width > 0) && use_ranking) {
+		use_ranking = false;
+		printf("ranking: turned off, since the maps have to be loaded back from their keys\n\n");
+	}
+
+	stringify_map(player_x + player_y * width);
+	level_hash = elf_hash(map_string);
+
+	init_deadlocks();
+
+	if (resume) {
+		load_checkpoint();
+	} else {
+		pages.shared = workers > 1;
+		pages.interleave = workers > 1;
+		allocate_tables();
+		pages.shared = false;
+		pages.interleave = false;
+	}
+	pending_discoveries = pages_map(&pages, MAX_MAPS * sizeof(u64));
+	if (workers > 1) {
+		stack_depths = pages_map(&pages, MAX_MAPS * sizeof(u32));
+	}
+	allocate_pushables();
+	if (workers == 1) {
+		install_signal_handlers(checkpointing);
+	}
+	perf_end(&perf, "parse", 0);
+
+	if (benchmarking) {
+		run_benchmarks(player_x, player_y);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (greedy || beam_width > 0) {
+		search_by_score(player_x, player_y);
+	}
+
+	if (workers > 1) {
+		start_workers();
+	}
+
 	// See https://en.wikipedia.org/wiki/Iterative_deepening_depth-first_search
 	// max_depth = 29; {
+	size_t searched_before = 0;
 	for (;; max_depth++) {
-		printf("max_depth: %zu\n", max_depth);
-		reset();
-		solve(player_x, player_y, 1, player_x + player_y * width);
-		print_area_stats();
+		if (worker == 0) {
+			printf("max_depth: %zu\n", max_depth);
+		}
+		double depth_start = anytime_now();
+		perf_begin(&perf, anytime.nodes);
+		while (!solve(player_x, player_y)) {}
+
+		if (workers > 1) {
+			wait_for_workers();
+		}
+		if (worker == 0) {
+			char phase[64];
+			snprintf(phase, sizeof(phase), "depth %zu", max_depth);
+			perf_end(&perf, phase, anytime.nodes);
+			if (workers > 1) {
+				size_t searched = __atomic_load_n(&lazy_smp->searched, __ATOMIC_RELAXED);
+				printf("workers: %zu searched %zu maps together in %.3f s\n", workers, searched - searched_before, anytime_now() - depth_start);
+				searched_before = searched;
+			}
+			print_area_stats();
+			fflush(stdout); // Before a worker that finds a solution prints it
+		}
+		current_solve_calls = 0;
+
+		// The start itself is deadlocked, so no depth is ever going to be enough
+		if (map_budgets[frames[1].index] == DEADLOCKED) {
+			break;
+		}
 	}
 
+	finish_worker();
+	if (worker > 0) {
+		_exit(EXIT_FAILURE);
+	}
 	printf("No solution was found :(\n");
+	print_result("unsolved");
 	exit(EXIT_FAILURE);
 }
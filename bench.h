@@ -0,0 +1,107 @@
+// Micro-benchmarks of a solver's kernels, like stringify_map() and the move functions,
+// so that a change to a single kernel can be measured without rerunning whole, noisy solves
+//
+// The kernels are fed maps that were recorded during a real search of the level, picked uniformly with reservoir sampling,
+// up to the depth that the search found a solution at, since a real search would've stopped there.
+// Every call is timed on its own, right after its map is loaded, so loading the maps isn't part of the time,
+// minus what reading the clock twice takes, which is timed the same way without a kernel.
+// What's reported is the median and the interquartile range of the runs, since an interrupted run only ever gets slower
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MAX_SAMPLES 4096
+#define BENCH_RECORD_NODES 1000000 // How many searched maps the samples are picked from
+#define BENCH_WARMUP_RUNS 3
+#define BENCH_RUNS 20
+
+struct bench {
+	size_t samples;
+	size_t seen;
+	uint64_t rng;
+	bool solved; // Whether the search found a solution, which ends the recording
+};
+
+static bool bench_recording(const struct bench *b) {
+	return b->seen < BENCH_RECORD_NODES && !b->solved;
+}
+
+// Returns the sample that the current map should be recorded in, or SIZE_MAX if it shouldn't be
+static size_t bench_slot(struct bench *b) {
+	b->seen++;
+	if (b->samples < BENCH_MAX_SAMPLES) {
+		return b->samples++;
+	}
+
+	// xorshift64
+	b->rng = b->rng ? b->rng : 0x9E3779B97F4A7C15ull;
+	b->rng ^= b->rng << 13;
+	b->rng ^= b->rng >> 7;
+	b->rng ^= b->rng << 17;
+
+	size_t j = b->rng % b->seen;
+	return j < BENCH_MAX_SAMPLES ? j : SIZE_MAX;
+}
+
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Loads every sample, and times the kernel on it if there is one, or else only the clock
+static double bench_time(const struct bench *b, void (*load)(size_t sample), void (*kernel)(size_t sample)) {
+	double total = 0;
+	for (size_t i = 0; i < b->samples; i++) {
+		load(i);
+		double start = bench_now();
+		if (kernel) {
+			kernel(i);
+		}
+		total += bench_now() - start;
+	}
+	return total;
+}
+
+static void bench_sort(double *ns, size_t size) {
+	// Insertion sort, since there are only BENCH_RUNS
+	for (size_t r = 1; r < size; r++) {
+		for (size_t q = r; q > 0 && ns[q - 1] > ns[q]; q--) {
+			double swap = ns[q];
+			ns[q] = ns[q - 1];
+			ns[q - 1] = swap;
+		}
+	}
+}
+
+static void bench_run(const struct bench *b, const char *name, void (*load)(size_t sample), void (*kernel)(size_t sample)) {
+	if (b->samples == 0) {
+		return;
+	}
+
+	for (size_t r = 0; r < BENCH_WARMUP_RUNS; r++) {
+		bench_time(b, load, kernel);
+		bench_time(b, load, NULL);
+	}
+
+	double ns[BENCH_RUNS];
+	double clock_ns[BENCH_RUNS];
+	for (size_t r = 0; r < BENCH_RUNS; r++) {
+		clock_ns[r] = bench_time(b, load, NULL) / b->samples * 1e9;
+		ns[r] = bench_time(b, load, kernel) / b->samples * 1e9;
+	}
+	bench_sort(clock_ns, BENCH_RUNS);
+	for (size_t r = 0; r < BENCH_RUNS; r++) {
+		ns[r] -= clock_ns[BENCH_RUNS / 2];
+	}
+	bench_sort(ns, BENCH_RUNS);
+
+	printf("bench %-32s %9.1f ns/op, IQR %7.1f, over %zu maps and %d runs\n", name, ns[BENCH_RUNS / 2], ns[3 * BENCH_RUNS / 4] - ns[BENCH_RUNS / 4], b->samples, BENCH_RUNS);
+}
+
+#endif
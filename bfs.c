@@ -1,41 +1,50 @@
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-#define MAX_HEIGHT 16
-#define MAX_WIDTH 16
+#include "anytime.h"
+#include "cache.h"
+#include "distances.h"
+#include "key.h"
+#include "levels.h"
+#include "pages.h"
+#include "perf.h"
+#include "preprocess.h"
+#include "rank.h"
+
+#define MAX_HEIGHT PREPROCESS_MAX_HEIGHT
+#define MAX_WIDTH PREPROCESS_MAX_WIDTH
 
 #define MAX_PATH_LENGTH 420420
 #define MAX_MAPS 42420420
 #define MAX_MAP_STRING_LENGTH 420420
 #define MAX_MAP_STRINGS_CHARS 420420420
-#define QUEUE_LENGTH 420420
+#define QUEUE_LENGTH 4204200 // Entries are only a pointer, so a long queue is cheap
+#define MAX_RANKED_BITS ((u64)MAX_MAPS * 64) // As much memory as buckets and chains take
+#define MAX_BATCH 1024
 
+typedef uint8_t u8;
+typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef int64_t i64;
 
-enum tile {
-	FLOOR,
-	WALL,
-	BOX,
-	STORAGE,
-	STORED_BOX,
-};
-
-struct entry {
-	enum tile map[MAX_HEIGHT][MAX_WIDTH];
-	size_t player_x;
-	size_t player_y;
-	char *path;
-	size_t empty_storages;
-};
-
 static enum tile map[MAX_HEIGHT][MAX_WIDTH];
 
 static size_t width = 0;
@@ -44,23 +53,115 @@ static size_t height = 0;
 static size_t player_x;
 static size_t player_y;
 
+// Where the cropped map starts in the original one
+static size_t origin_x;
+static size_t origin_y;
+
+// Boxes on storage that got turned into walls, which are still printed as boxes
+static bool frozen[MAX_HEIGHT][MAX_WIDTH];
+
+// The pushes it takes to get a box from each tile onto each storage
+static struct distances distances;
+static bool dead_tiles[MAX_HEIGHT][MAX_WIDTH]; // Tiles that a box mustn't be pushed onto
+static bool use_nearest; // Whether the boxes' fewest pushes to any storage bound how deep --hybrid still has to go
+
 static i64 empty_storages = 0;
 
 static size_t entries_seen;
 
+// solve() dequeues this many maps at a time, and prefetches all of their memo probes before resolving any of them,
+// so that the cache misses of a whole batch overlap, instead of every probe waiting on the one before it
+static size_t batch_size = 16;
+
+struct probe {
+	char *entry;
+	u64 hash; // The bucket, or the first bit index with --bitstate
+};
+
 static char path[MAX_PATH_LENGTH];
 static size_t path_length;
 
-static char *maps[MAX_MAPS];
+// The path to the map with the fewest empty storages so far, which is what a search that hits a limit reports
+static i64 best_empty_storages;
+static char best_path[MAX_PATH_LENGTH];
+static size_t best_path_length;
+
+static struct anytime anytime;
+
+static struct perf perf; // Only enabled with --perf
+
+// With --serve or --socket, levels are solved one after another, and every result is a single line
+static bool serving;
+static jmp_buf level_done;
+static FILE *results;
+static size_t levels_served;
+static bool use_layers;
+static size_t partitions = 1; // The processes that --partitions splits the layers over
+static size_t partition; // 0 for the process that was started, which prints the progress
+static bool partitioned; // Whether the other processes were started yet
+
+static struct cache cache;
+static bool from_cache; // Whether the result came out of the cache, so it doesn't need to be stored again
+
+// The memo tables, and the bitstate and ranked bit arrays, are on huge pages once they're dense enough, see pages.h
+static struct pages pages;
+
+static char **maps;
 static size_t maps_size;
 
-static char map_strings[MAX_MAP_STRINGS_CHARS];
+static char *map_strings;
 static size_t map_strings_size;
 
-static u32 buckets[MAX_MAPS];
-static u32 chains[MAX_MAPS];
-
-static struct entry queue[QUEUE_LENGTH];
+static u32 *buckets;
+static u32 *chains;
+
+// A bucket is only in use when its generation is the current one, so the next level clears the whole table
+// by bumping the generation, instead of memsetting it and faulting every page in all over again
+static u32 *bucket_generations;
+static u32 generation = 1;
+
+// With --bitstate, maps are only remembered as a few set bits, like SPIN's supertrace mode
+// A map whose bits all happen to be set already gets skipped, so solutions can be missed,
+// but many more maps fit in the same memory
+static u64 *bitstate;
+static u64 bitstate_bits;
+static u64 bitstate_bits_set;
+static size_t bitstate_hashes = 3;
+static double expected_omissions; // The sum of the chances that each map was wrongly skipped
+
+// With --hybrid, the queue stops growing once the process uses more than hybrid_memory,
+// and every map still in it becomes a root of an iterative deepening search, see deepen()
+static size_t hybrid_memory; // Bytes, 0 without --hybrid, which already leaves room for the transpositions
+static bool deepening;
+static size_t deepening_bound; // The path length that the current iteration deepens to
+static bool cut_off; // Whether the bound kept any map of the current iteration from being expanded
+
+// A lossy table of the maps the current iteration already deepened, and at which path length,
+// where a map that gets overwritten is only searched again. It takes up to an eighth of --hybrid's memory,
+// but at least TRANSPOSITIONS_MIN_SIZE entries, or 1 MiB, since a table that's too small for the maps of an iteration
+// searches most of them over and over, which made a --hybrid 1 of level_47601.txt take minutes instead of a second
+#define TRANSPOSITIONS_MIN_SIZE (1 << 16)
+struct transposition {
+	u64 hash;
+	u32 iteration;
+	u32 path_length;
+};
+static struct transposition *transpositions;
+static size_t transpositions_size; // A power of 2
+static u32 iteration;
+
+// When every map fits in MAX_RANKED_BITS, the queue remembers maps as one bit at their rank, instead of as strings
+static struct ranking ranking;
+static u16 box_squares[MAX_HEIGHT * MAX_WIDTH]; // The ranking's square of each floor tile a box can be on, or NO_FLOOR
+static u64 *ranked;
+static size_t ranked_size;
+
+// Every entry is a map's key followed by its path, in a single allocation
+static char *queue[QUEUE_LENGTH];
+
+// The queue and the memo tables only store which floor tiles have a box and where the player is, see key.h
+static struct key_format key_format;
+static char key[KEY_MAX_LENGTH];
 static size_t queue_start_index = 0;
 static size_t queue_end_index = 0;
 
@@ -102,51 +203,119 @@ static void print_bfs_stats(void) {
 	printf("queue_end_index: %zu\n", queue_end_index);
 	// printf("queue_length: %zu\n", );
 	printf("branching factor: %.2f\n", pow(entries_seen, 1.0/path_length)); // O(branching_factor ^ depth)
+	printf("throughput: %.0f nodes/s\n", anytime.nodes / (anytime_now() - anytime.start));
+	if (bitstate) {
+		double fill = (double)bitstate_bits_set / bitstate_bits;
+		printf("bitstate: %.3g%% of %llu bits set, so the next new map gets skipped with chance %.3g\n", fill * 100, (unsigned long long)bitstate_bits, pow(fill, bitstate_hashes));
+		printf("bitstate: %.3g maps expected to have been skipped, so with chance %.3g none were\n", expected_omissions, exp(-expected_omissions));
+	}
+	pages_print(&pages);
 }
 
 static void print_map(void) {
 	print_bfs_stats();
 	printf("width: %zu\n", width);
 	printf("height: %zu\n", height);
-	printf("player_x: %zu\n", player_x);
-	printf("player_y: %zu\n", player_y);
+	printf("player_x: %zu\n", player_x + origin_x);
+	printf("player_y: %zu\n", player_y + origin_y);
 	printf("empty_storages: %zu\n", empty_storages);
 	printf("path_length: %zu\n", path_length);
 	printf("path: '%.*s'\n", (int)path_length, path);
 	for (size_t y = 0; y < height; y++) {
 		for (size_t x = 0; x < width; x++) {
-			printf("%c", x == player_x && y == player_y ? '@' : tile_to_char(map[y][x]));
+			printf("%c", x == player_x && y == player_y ? '@' : frozen[y][x] ? tile_to_char(STORED_BOX) : tile_to_char(map[y][x]));
 		}
 		printf("\n");
 	}
 	printf("\n");
 }
 
+static void remember_best(void) {
+	best_empty_storages = empty_storages;
+	memcpy(best_path, path, path_length);
+	best_path_length = path_length;
+}
+
+static void print_result(const char *status) {
+	// A bitstate search that didn't find a solution doesn't prove there is none
+	bool solved = strcmp(status, "solved") == 0;
+	if (!from_cache && (solved || (strcmp(status, "unsolved") == 0 && !bitstate))) {
+		path[path_length] = '\0';
+		cache_store(&cache, &anytime, status, solved ? path_length : 0, solved ? path : "");
+	}
+
+	if (serving) {
+		fprintf(results, "level=%zu ", levels_served);
+		anytime_print_fields(results, &anytime, status);
+		if (!solved) {
+			fprintf(results, " best_empty_storages=%zu", best_empty_storages);
+		}
+		fprintf(results, " moves=%zu path=%.*s\n",
+			solved ? path_length : best_path_length,
+			(int)(solved ? path_length : best_path_length), solved ? path : best_path);
+		fflush(results);
+		return;
+	}
+
+	anytime_print(&anytime, status);
+
+	// A solution is already printed as the path
+	if (strcmp(status, "solved") == 0) {
+		return;
+	}
+	printf("best empty_storages: %zu\n", best_empty_storages);
+	printf("best path_length: %zu\n", best_path_length);
+	printf("best path: '%.*s'\n", (int)best_path_length, best_path);
+}
+
+static void exit_partitions(int status);
+
+// Ends the level, which only ends the process when it isn't serving more levels
+static void finish(int status) {
+	if (serving) {
+		longjmp(level_done, 1);
+	}
+	if (partitioned) {
+		exit_partitions(status);
+	}
+	exit(status);
+}
+
 static void check_is_solved(void) {
 	if (empty_storages == 0) {
+		perf_begin(&perf, anytime.nodes);
 		printf("Solved!\n");
 		print_map();
-		exit(EXIT_SUCCESS);
+		print_result("solved");
+		perf_end(&perf, "output", anytime.nodes);
+		finish(EXIT_SUCCESS);
 	}
 }
 
+static void key_map(void);
+static void descend(void);
+
 static void enqueue() {
-	struct entry e;
+	if (deepening) {
+		descend();
+		return;
+	}
 
-	memcpy(e.map, map, sizeof(map));
-	e.player_x = player_x;
-	e.player_y = player_y;
-	path[path_length] = '\0';
-	e.path = strdup(path);
-	// printf("Storing path '%s'\n", e.path);
-	e.empty_storages = empty_storages;
+	key_map();
+	size_t key_size = key_format.length + 1;
+	char *e = malloc(key_size + path_length + 1);
+	memcpy(e, key, key_size);
+	memcpy(e + key_size, path, path_length);
+	e[key_size + path_length] = '\0';
+	// printf("Storing path '%s'\n", e + key_size);
 
 	queue[queue_end_index++] = e;
 	queue_end_index %= QUEUE_LENGTH;
 
 	if (queue_start_index == queue_end_index) {
 		fprintf(stderr, "The queue is full! You need to up the QUEUE_LENGTH #define\n");
-		exit(EXIT_FAILURE);
+		print_result("error");
+		finish(EXIT_FAILURE);
 	}
 }
 
@@ -160,8 +329,8 @@ static void up(void) {
 		path_length--;
 		player_y++;
 	} else if (map[player_y-1][player_x] == BOX && (map[player_y-2][player_x] == FLOOR || map[player_y-2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y-2][player_x] == FLOOR && map[player_y-3][player_x] == WALL && (map[player_y-2][player_x-1] == WALL || map[player_y-2][player_x+1] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y-2][player_x]) {
 			return;
 		}
 
@@ -184,8 +353,8 @@ static void up(void) {
 		map[player_y-2][player_x] = map[player_y-2][player_x] == BOX ? FLOOR : STORAGE;
 		map[player_y-1][player_x] = BOX;
 	} else if (map[player_y-1][player_x] == STORED_BOX && (map[player_y-2][player_x] == FLOOR || map[player_y-2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y-2][player_x] == FLOOR && map[player_y-3][player_x] == WALL && (map[player_y-2][player_x-1] == WALL || map[player_y-2][player_x+1] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y-2][player_x]) {
 			return;
 		}
 
@@ -221,8 +390,8 @@ static void down(void) {
 		path_length--;
 		player_y--;
 	} else if (map[player_y+1][player_x] == BOX && (map[player_y+2][player_x] == FLOOR || map[player_y+2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y+2][player_x] == FLOOR && map[player_y+3][player_x] == WALL && (map[player_y+2][player_x-1] == WALL || map[player_y+2][player_x+1] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y+2][player_x]) {
 			return;
 		}
 
@@ -245,8 +414,8 @@ static void down(void) {
 		map[player_y+2][player_x] = map[player_y+2][player_x] == BOX ? FLOOR : STORAGE;
 		map[player_y+1][player_x] = BOX;
 	} else if (map[player_y+1][player_x] == STORED_BOX && (map[player_y+2][player_x] == FLOOR || map[player_y+2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y+2][player_x] == FLOOR && map[player_y+3][player_x] == WALL && (map[player_y+2][player_x-1] == WALL || map[player_y+2][player_x+1] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y+2][player_x]) {
 			return;
 		}
 
@@ -282,8 +451,8 @@ static void left(void) {
 		path_length--;
 		player_x++;
 	} else if (map[player_y][player_x-1] == BOX && (map[player_y][player_x-2] == FLOOR || map[player_y][player_x-2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x-2] == FLOOR && map[player_y][player_x-3] == WALL && (map[player_y-1][player_x-2] == WALL || map[player_y+1][player_x-2] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x-2]) {
 			return;
 		}
 
@@ -306,8 +475,8 @@ static void left(void) {
 		map[player_y][player_x-2] = map[player_y][player_x-2] == BOX ? FLOOR : STORAGE;
 		map[player_y][player_x-1] = BOX;
 	} else if (map[player_y][player_x-1] == STORED_BOX && (map[player_y][player_x-2] == FLOOR || map[player_y][player_x-2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x-2] == FLOOR && map[player_y][player_x-3] == WALL && (map[player_y-1][player_x-2] == WALL || map[player_y+1][player_x-2] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x-2]) {
 			return;
 		}
 
@@ -343,8 +512,8 @@ static void right(void) {
 		path_length--;
 		player_x--;
 	} else if (map[player_y][player_x+1] == BOX && (map[player_y][player_x+2] == FLOOR || map[player_y][player_x+2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x+2] == FLOOR && map[player_y][player_x+3] == WALL && (map[player_y-1][player_x+2] == WALL || map[player_y+1][player_x+2] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x+2]) {
 			return;
 		}
 
@@ -367,8 +536,8 @@ static void right(void) {
 		map[player_y][player_x+2] = map[player_y][player_x+2] == BOX ? FLOOR : STORAGE;
 		map[player_y][player_x+1] = BOX;
 	} else if (map[player_y][player_x+1] == STORED_BOX && (map[player_y][player_x+2] == FLOOR || map[player_y][player_x+2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x+2] == FLOOR && map[player_y][player_x+3] == WALL && (map[player_y-1][player_x+2] == WALL || map[player_y+1][player_x+2] == WALL)) {
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x+2]) {
 			return;
 		}
 
@@ -422,114 +591,1638 @@ static char *stringify_map(void) {
 	return strdup(map_string);
 }
 
+// Returns whether the map_string hadn't been seen before, where bucket_index is memo_hash() of it
+static bool memoize(const char *map_string, u32 bucket_index) {
+	u32 head = bucket_generations[bucket_index] == generation ? buckets[bucket_index] : UINT32_MAX;
+	u32 i = head;
+
+	while (true) {
+		if (i == UINT32_MAX) {
+			size_t map_string_length = strlen(map_string);
+			if (maps_size == MAX_MAPS || map_strings_size + map_string_length+1 > MAX_MAP_STRINGS_CHARS) {
+				fprintf(stderr, "The memo table is full! You need to up the MAX_MAPS and MAX_MAP_STRINGS_CHARS #defines, or pass --bitstate\n");
+				print_result("error");
+				finish(EXIT_FAILURE);
+			}
+
+			// fprintf(stderr, "Memoizing map:\n%s\n", map_string);
+			maps[maps_size] = map_strings + map_strings_size;
+			memcpy(map_strings + map_strings_size, map_string, map_string_length+1);
+			map_strings_size += map_string_length+1;
+
+			// If this map hasn't been seen before, memoize it
+			chains[maps_size] = head;
+			buckets[bucket_index] = maps_size++;
+			bucket_generations[bucket_index] = generation;
+
+			return true;
+		}
+
+		if (strcmp(map_string, maps[i]) == 0) {
+			// printf("Already memoized path '%s'\n", path);
+			return false; // Memoization, by stopping if the map_string has been seen before
+		}
+
+		i = chains[i];
+	}
+}
+
+// Like memoize(), but only looks the map_string up
+static bool memoized(const char *map_string, u32 bucket_index) {
+	if (bucket_generations[bucket_index] != generation) {
+		return false;
+	}
+	for (u32 i = buckets[bucket_index]; i != UINT32_MAX; i = chains[i]) {
+		if (strcmp(map_string, maps[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// FNV-1a, since elf_hash() only has 28 bits, which isn't enough to address a big bit array
+static u64 fnv_hash(const char *s) {
+	u64 h = 0xcbf29ce484222325;
+	for (const unsigned char *c = (const unsigned char *)s; *c; c++) {
+		h = (h ^ *c) * 0x100000001b3;
+	}
+	return h;
+}
+
+static u64 memo_hash(const char *map_string) {
+	return bitstate ? fnv_hash(map_string) : elf_hash(map_string) % MAX_MAPS;
+}
+
+static u64 bitstate_step(u64 h1) {
+	u64 h2 = h1 * 0x9E3779B97F4A7C15;
+	return (h2 ^ (h2 >> 31)) | 1;
+}
+
+// Prefetches what memoize() or bitstate_memoize() will read for the hash
+static void prefetch_probe(u64 hash) {
+	if (bitstate) {
+		u64 h2 = bitstate_step(hash);
+		for (size_t i = 0; i < bitstate_hashes; i++) {
+			__builtin_prefetch(&bitstate[(hash + i * h2) % bitstate_bits / 64], 1);
+		}
+	} else {
+		__builtin_prefetch(&bucket_generations[hash]);
+		__builtin_prefetch(&buckets[hash]);
+	}
+}
+
+// The k bit indices are h1 + i * h2, which behaves like k independent hashes
+// See "Less Hashing, Same Performance: Building a Better Bloom Filter" by Kirsch and Mitzenmacher
+static bool bitstate_memoize(u64 h1) {
+	u64 h2 = bitstate_step(h1);
+
+	double fill = (double)bitstate_bits_set / bitstate_bits;
+
+	bool seen = true;
+	for (size_t i = 0; i < bitstate_hashes; i++) {
+		u64 bit = (h1 + i * h2) % bitstate_bits;
+		u64 mask = (u64)1 << (bit % 64);
+		if (!(bitstate[bit / 64] & mask)) {
+			bitstate[bit / 64] |= mask;
+			bitstate_bits_set++;
+			seen = false;
+		}
+	}
+
+	if (!seen) {
+		expected_omissions += pow(fill, bitstate_hashes);
+	}
+	return !seen;
+}
+
+static void allocate_bitstate(size_t mebibytes) {
+	bitstate_bits = (u64)mebibytes << 23;
+	if (bitstate_bits == 0 || bitstate_hashes == 0) {
+		fprintf(stderr, "--bitstate and --bitstate-hashes need to be at least 1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bitstate = pages_map(&pages, bitstate_bits / 8);
+}
+
+static void allocate_tables(void) {
+	maps = pages_map(&pages, MAX_MAPS * sizeof(char *));
+	map_strings = pages_map(&pages, MAX_MAP_STRINGS_CHARS);
+	buckets = pages_map(&pages, MAX_MAPS * sizeof(u32));
+	chains = pages_map(&pages, MAX_MAPS * sizeof(u32));
+	bucket_generations = pages_map(&pages, MAX_MAPS * sizeof(u32));
+}
+
+static bool ranked_memoize(void);
+static void unkey_map(const char *map_key);
+static void deepen(void);
+
+// Ends the counters of the depth that was just finished, and starts them for the next one
+static void perf_next_depth(size_t depth) {
+	char phase[64];
+	snprintf(phase, sizeof(phase), "depth %zu", depth);
+	perf_end(&perf, phase, anytime.nodes);
+	perf_begin(&perf, anytime.nodes);
+}
+
 static void solve(void) {
+	static struct probe probes[MAX_BATCH];
 	size_t depth = 0;
+	perf_begin(&perf, anytime.nodes);
+
+	size_t next_hybrid_check = ANYTIME_CHECK_INTERVAL;
 
 	while (queue_start_index != queue_end_index) {
-		struct entry e = queue[queue_start_index++];
-		queue_start_index %= QUEUE_LENGTH;
+		if (hybrid_memory != 0 && entries_seen >= next_hybrid_check) {
+			next_hybrid_check = entries_seen + ANYTIME_CHECK_INTERVAL;
+			if (anytime_rss() > hybrid_memory) {
+				deepen();
+				return;
+			}
+		}
 
-		memcpy(map, e.map, sizeof(map));
-		player_x = e.player_x;
-		player_y = e.player_y;
-		char *map_string = stringify_map();
-		// fprintf(stderr, "Dequeued map:\n%s", map_string);
-		path_length = strlen(e.path);
-		if (path_length > depth) {
-			depth = path_length;
-			printf("Depth %zu\n", depth);
-			print_bfs_stats();
+		// The maps stay in the queue until they're expanded, so that reset() can still free them
+		size_t batch = 0;
+		if (!ranked) {
+			for (size_t i = queue_start_index; batch < batch_size && i != queue_end_index; i = (i + 1) % QUEUE_LENGTH) {
+				probes[batch].entry = queue[i];
+				probes[batch].hash = memo_hash(queue[i]);
+				prefetch_probe(probes[batch].hash);
+				batch++;
+			}
+
+			// By now most of the buckets have arrived, so the first map of each chain can be on its way too
+			if (!bitstate) {
+				for (size_t b = 0; b < batch; b++) {
+					u64 h = probes[b].hash;
+					if (bucket_generations[h] == generation) {
+						__builtin_prefetch(maps[buckets[h]]);
+					}
+				}
+			}
+		} else {
+			probes[batch++].entry = queue[queue_start_index];
 		}
-		memcpy(path, e.path, path_length);
-		// fprintf(stderr, "With path that is %zu steps long:\n'%.*s'\n\n", path_length, (int)path_length, path);
-		empty_storages = e.empty_storages;
 
-		entries_seen++;
+		for (size_t b = 0; b < batch; b++) {
+			char *e = probes[b].entry;
+			queue_start_index = (queue_start_index + 1) % QUEUE_LENGTH;
+
+			size_t key_size = key_format.length + 1;
+			path_length = strlen(e + key_size);
+			if (path_length > depth) {
+				perf_next_depth(depth);
+				depth = path_length;
+				printf("Depth %zu\n", depth);
+				print_bfs_stats();
+			}
+			memcpy(path, e + key_size, path_length);
+			// fprintf(stderr, "With path that is %zu steps long:\n'%.*s'\n\n", path_length, (int)path_length, path);
 
-		u32 bucket_index = elf_hash(map_string) % MAX_MAPS;
+			entries_seen++;
+			if (entries_seen >= pages.next_promote) {
+				pages_promote(&pages, entries_seen);
+			}
 
-		u32 i = buckets[bucket_index];
+			if (anytime_node(&anytime)) {
+				free(e);
+				print_result("limit");
+				finish(EXIT_FAILURE);
+			}
 
-		while (true) {
-			if (i == UINT32_MAX) {
-				// fprintf(stderr, "Memoizing map:\n%s\n", map_string);
-				maps[maps_size] = map_strings + map_strings_size;
-				memcpy(map_strings + map_strings_size, map_string, strlen(map_string)+1);
-				map_strings_size += strlen(map_string)+1;
+			// A map that was seen before was already expanded, and remembered if it was the best, so it isn't even unkeyed
+			bool is_new;
+			if (ranked) {
+				unkey_map(e);
+				is_new = ranked_memoize();
+			} else {
+				is_new = bitstate ? bitstate_memoize(probes[b].hash) : memoize(e, probes[b].hash);
+				if (is_new) {
+					unkey_map(e);
+				}
+			}
+			free(e);
 
-				// If this map hasn't been seen before, memoize it
-				chains[maps_size] = buckets[bucket_index];
-				buckets[bucket_index] = maps_size++;
+			if (is_new) {
+				if (empty_storages < best_empty_storages) {
+					remember_best();
+				}
 
 				up();
 				down();
 				left();
 				right();
+			}
+		}
+	}
+}
+
+static bool is_wall(size_t x, size_t y) {
+	return x >= width || y >= height || map[y][x] == WALL; // x-1 and y-1 wrap around when they go below 0
+}
+
+static size_t count_tiles(bool (*counts)(enum tile)) {
+	size_t count = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			count += counts(map[y][x]);
+		}
+	}
+	return count;
+}
+
+static bool is_box(enum tile t) {
+	return t == BOX || t == STORED_BOX;
+}
+
+static void preprocess(void) {
+	struct preprocess p = {.map=map, .frozen=frozen, .width=width, .height=height, .player_x=player_x, .player_y=player_y};
+	preprocess_level(&p);
+	width = p.width;
+	height = p.height;
+	player_x = p.player_x;
+	player_y = p.player_y;
+	origin_x = p.origin_x;
+	origin_y = p.origin_y;
+}
+
+// With --layers, the BFS goes one whole layer at a time, where a layer is every map that is a certain number of moves away.
+// Maps are packed into a few u64 words: one bit per floor tile that has a box on it, followed by the player's floor tile,
+// in as many bits as the number of floor tiles needs, so that small maps get the smallest states.
+// The next layer is generated into a flat array, radix sorted, deduplicated,
+// and then every earlier layer is subtracted from it with a linear merge, so the memory is only ever accessed sequentially
+
+#define MAX_FLOORS (MAX_HEIGHT * MAX_WIDTH)
+#define MAX_PLAYER_BITS 12
+#define MAX_STATE_WORDS ((MAX_FLOORS + MAX_PLAYER_BITS + 63) / 64)
+#define NO_FLOOR UINT16_MAX
+
+struct layer {
+	u64 *states;
+	size_t size;
+};
+
+_Static_assert(MAX_FLOORS <= 1 << MAX_PLAYER_BITS, "the player's floor tile has to fit in MAX_PLAYER_BITS");
+
+static size_t floors_size;
+static size_t player_bits;
+static u64 player_mask;
+static bool player_straddles; // Whether the player's bits run over into the next word
+static u16 floor_indices[MAX_HEIGHT][MAX_WIDTH];
+static u8 floor_x[MAX_FLOORS];
+static u8 floor_y[MAX_FLOORS];
+static bool floor_storages[MAX_FLOORS];
+static u16 neighbors[MAX_FLOORS][4]; // Up, down, left and right
+static bool dead_floors[MAX_FLOORS]; // Floor tiles that are dead, like up() checks
+static u64 storage_words[MAX_STATE_WORDS];
+
+static size_t state_words;
+static struct layer layers[MAX_PATH_LENGTH];
+static size_t layers_size;
+static u64 *next_layer; // The successors of the current layer, before they are sorted
+
+static const char move_chars[4] = {'u', 'd', 'l', 'r'};
+static const char push_chars[4] = {'U', 'D', 'L', 'R'};
+
+static bool state_has_box(const u64 *state, size_t floor) {
+	return (state[floor / 64] >> (floor % 64)) & 1;
+}
+
+static void state_flip_box(u64 *state, size_t floor) {
+	state[floor / 64] ^= (u64)1 << (floor % 64);
+}
+
+static size_t state_player(const u64 *state) {
+	size_t bit = floors_size;
+	u64 player = state[bit / 64] >> (bit % 64);
+	if (player_straddles) {
+		player |= state[bit / 64 + 1] << (64 - bit % 64);
+	}
+	return player & player_mask;
+}
+
+static void state_set_player(u64 *state, size_t player) {
+	size_t bit = floors_size;
+	state[bit / 64] &= ~(player_mask << (bit % 64));
+	state[bit / 64] |= (u64)player << (bit % 64);
+	if (player_straddles) {
+		state[bit / 64 + 1] &= ~(player_mask >> (64 - bit % 64));
+		state[bit / 64 + 1] |= (u64)player >> (64 - bit % 64);
+	}
+}
+
+static int state_compare(const u64 *a, const u64 *b) {
+	for (size_t w = state_words; w-- > 0;) {
+		if (a[w] != b[w]) {
+			return a[w] < b[w] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static bool state_is_solved(const u64 *state) {
+	for (size_t w = 0; w < state_words; w++) {
+		if (storage_words[w] & ~state[w]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The push distances, and the tiles that are dead, see preprocess.h
+static void init_distances(void) {
+	struct preprocess p = {.map=map, .frozen=frozen, .width=width, .height=height};
+	bool stuck;
+	use_nearest = preprocess_dead_tiles(&p, &distances, dead_tiles, &stuck);
+	if (stuck) {
+		fprintf(stderr, "A box is on a tile that no storage can be reached from, so no solution exists :(\n");
+		print_result("unsolved");
+		finish(EXIT_FAILURE);
+	}
+}
+
+// The fewest pushes that the boxes still need, if each of them could have the nearest storage to itself
+static size_t nearest_pushes(void) {
+	size_t pushes = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		if (is_box(map[floor_y[i]][floor_x[i]])) {
+			pushes += distances.nearest[floor_x[i] + floor_y[i] * width];
+		}
+	}
+	return pushes;
+}
+
+static void init_floors(void) {
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			floor_indices[y][x] = NO_FLOOR;
+			if (!is_wall(x, y)) {
+				floor_indices[y][x] = floors_size;
+				floor_x[floors_size] = x;
+				floor_y[floors_size] = y;
+				floor_storages[floors_size] = map[y][x] == STORAGE || map[y][x] == STORED_BOX;
+				floors_size++;
+			}
+		}
+	}
+	player_bits = 1;
+	while (((size_t)1 << player_bits) < floors_size) {
+		player_bits++;
+	}
+	key_init(&key_format, floors_size, count_tiles(is_box));
+	player_mask = ((u64)1 << player_bits) - 1;
+	player_straddles = floors_size % 64 + player_bits > 64;
+	state_words = (floors_size + player_bits + 63) / 64;
+
+	for (size_t i = 0; i < floors_size; i++) {
+		size_t x = floor_x[i];
+		size_t y = floor_y[i];
+		neighbors[i][0] = is_wall(x, y-1) ? NO_FLOOR : floor_indices[y-1][x];
+		neighbors[i][1] = is_wall(x, y+1) ? NO_FLOOR : floor_indices[y+1][x];
+		neighbors[i][2] = is_wall(x-1, y) ? NO_FLOOR : floor_indices[y][x-1];
+		neighbors[i][3] = is_wall(x+1, y) ? NO_FLOOR : floor_indices[y][x+1];
+
+		bool storage = map[y][x] == STORAGE || map[y][x] == STORED_BOX;
+		dead_floors[i] = dead_tiles[y][x];
+		if (storage) {
+			state_flip_box(storage_words, i);
+		}
+	}
+}
+
+static void pack_map(u64 *state) {
+	memset(state, 0, state_words * sizeof(u64));
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		if (t == BOX || t == STORED_BOX) {
+			state_flip_box(state, i);
+		}
+	}
+	state_set_player(state, floor_indices[player_y][player_x]);
+}
+
+static void unpack_map(const u64 *state) {
+	empty_storages = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		bool storage = t == STORAGE || t == STORED_BOX;
+		bool box = state_has_box(state, i);
+		map[floor_y[i]][floor_x[i]] = storage ? (box ? STORED_BOX : STORAGE) : (box ? BOX : FLOOR);
+		empty_storages += storage && !box;
+	}
+	player_x = floor_x[state_player(state)];
+	player_y = floor_y[state_player(state)];
+}
 
-				break;
+// Writes the map's key, which only looks at the floor tiles, unlike stringify_map()
+static void key_map(void) {
+	static u16 box_floors[MAX_FLOORS];
+	size_t boxes = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		box_floors[boxes] = i;
+		boxes += t == BOX || t == STORED_BOX; // Branchless, since whether a floor tile has a box is a coin flip
+	}
+	key_encode(&key_format, key, box_floors, boxes, floor_indices[player_y][player_x]);
+}
+
+static void unkey_map(const char *map_key) {
+	static const enum tile tiles[2][2] = {{FLOOR, BOX}, {STORAGE, STORED_BOX}};
+	static bool has_box[MAX_FLOORS];
+	size_t player = key_decode(&key_format, map_key, has_box);
+
+	empty_storages = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		map[floor_y[i]][floor_x[i]] = tiles[floor_storages[i]][has_box[i]];
+		empty_storages += floor_storages[i] && !has_box[i];
+	}
+	player_x = floor_x[player];
+	player_y = floor_y[player];
+}
+
+// Sorts by one byte at a time, skipping the bytes that are the same in every state
+static void radix_sort(u64 *states, u64 *scratch, size_t n) {
+	u64 *from = states;
+	u64 *to = scratch;
+
+	for (size_t w = 0; w < state_words; w++) {
+		u64 all_and = UINT64_MAX;
+		u64 all_or = 0;
+		for (size_t i = 0; i < n; i++) {
+			all_and &= from[i * state_words + w];
+			all_or |= from[i * state_words + w];
+		}
+
+		for (size_t shift = 0; shift < 64; shift += 8) {
+			if ((((all_and ^ all_or) >> shift) & 0xff) == 0) {
+				continue;
 			}
 
-			if (strcmp(map_string, maps[i]) == 0) {
-				// printf("Already memoized path '%s'\n", path);
-				break; // Memoization, by stopping if the map_string has been seen before
+			size_t offsets[256] = {0};
+			for (size_t i = 0; i < n; i++) {
+				offsets[(from[i * state_words + w] >> shift) & 0xff]++;
+			}
+			size_t sum = 0;
+			for (size_t b = 0; b < 256; b++) {
+				size_t count = offsets[b];
+				offsets[b] = sum;
+				sum += count;
+			}
+			for (size_t i = 0; i < n; i++) {
+				size_t b = (from[i * state_words + w] >> shift) & 0xff;
+				memcpy(to + offsets[b]++ * state_words, from + i * state_words, state_words * sizeof(u64));
 			}
 
-			i = chains[i];
+			u64 *swap = from;
+			from = to;
+			to = swap;
 		}
+	}
 
-		free(map_string);
-		free(e.path);
+	if (from != states) {
+		memcpy(states, from, n * state_words * sizeof(u64));
+	}
+}
+
+static size_t deduplicate(u64 *states, size_t n) {
+	size_t kept = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (kept == 0 || state_compare(states + (kept - 1) * state_words, states + i * state_words) != 0) {
+			memmove(states + kept * state_words, states + i * state_words, state_words * sizeof(u64));
+			kept++;
+		}
+	}
+	return kept;
+}
+
+// Removes the states that are in the sorted layer, which is a linear merge since both are sorted
+static size_t subtract(u64 *states, size_t n, const struct layer *l) {
+	size_t kept = 0;
+	size_t j = 0;
+	for (size_t i = 0; i < n; i++) {
+		const u64 *state = states + i * state_words;
+		while (j < l->size && state_compare(l->states + j * state_words, state) < 0) {
+			j++;
+		}
+		if (j < l->size && state_compare(l->states + j * state_words, state) == 0) {
+			continue;
+		}
+		memmove(states + kept * state_words, state, state_words * sizeof(u64));
+		kept++;
+	}
+	return kept;
+}
+
+static bool layer_contains(const struct layer *l, const u64 *state) {
+	size_t lo = 0;
+	size_t hi = l->size;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = state_compare(l->states + mid * state_words, state);
+		if (c == 0) {
+			return true;
+		}
+		if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return false;
+}
+
+static bool in_layer(size_t k, const u64 *state);
+
+// Walks back from the solved state, by finding a state in each earlier layer that the move could have come from
+static void reconstruct_path(const u64 *solved, size_t depth) {
+	u64 state[MAX_STATE_WORDS];
+	memcpy(state, solved, state_words * sizeof(u64));
+	path_length = depth;
+
+	for (size_t k = depth; k-- > 0;) {
+		size_t p = state_player(state);
+		bool found = false;
+
+		for (size_t d = 0; d < 4 && !found; d++) {
+			size_t back = neighbors[p][d ^ 1];
+			if (back == NO_FLOOR || state_has_box(state, back)) {
+				continue;
+			}
+
+			u64 previous[MAX_STATE_WORDS];
+			memcpy(previous, state, state_words * sizeof(u64));
+			state_set_player(previous, back);
+			if (in_layer(k, previous)) {
+				path[k] = move_chars[d];
+				found = true;
+			}
+
+			size_t box = neighbors[p][d];
+			if (!found && box != NO_FLOOR && state_has_box(state, box)) {
+				state_flip_box(previous, box);
+				state_flip_box(previous, p);
+				if (in_layer(k, previous)) {
+					path[k] = push_chars[d];
+					found = true;
+				}
+			}
+
+			if (found) {
+				memcpy(state, previous, state_words * sizeof(u64));
+			}
+		}
+
+		if (!found) {
+			abort();
+		}
+	}
+}
+
+// Boxes can't be pushed onto dead tiles, so only the boxes that start out on one need a square there
+static bool init_ranking(void) {
+	size_t squares = 0;
+	size_t boxes = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		bool box = t == BOX || t == STORED_BOX;
+		box_squares[i] = dead_floors[i] && !box ? NO_FLOOR : squares++;
+		boxes += box;
+	}
+
+	rank_init(&ranking, squares, boxes);
+	u64 bits = rank_multiply(rank_size(&ranking), floors_size);
+	if (bits > MAX_RANKED_BITS) {
+		printf("ranking: disabled, since there are more maps than MAX_RANKED_BITS\n\n");
+		return false;
+	}
+	printf("ranking: %llu maps, so they are ranked instead of hashed\n\n", (unsigned long long)bits);
+
+	ranked_size = (bits + 63) / 64 * sizeof(u64);
+	ranked = pages_map(&pages, ranked_size);
+	return true;
+}
+
+// Returns whether the map hadn't been seen before
+static u64 ranked_bit(void) {
+	u16 squares[RANK_MAX_BOXES];
+	size_t boxes = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		if (t == BOX || t == STORED_BOX) {
+			squares[boxes++] = box_squares[i];
+		}
+	}
+
+	return rank_boxes(&ranking, squares) * floors_size + floor_indices[player_y][player_x];
+}
+
+static bool ranked_memoize(void) {
+	u64 bit = ranked_bit();
+	u64 mask = (u64)1 << (bit % 64);
+	if (ranked[bit / 64] & mask) {
+		return false;
+	}
+	ranked[bit / 64] |= mask;
+	return true;
+}
+
+// Whether the breadth-first search already expanded the map that key_map() just keyed
+static bool expanded_by_bfs(void) {
+	if (ranked) {
+		u64 bit = ranked_bit();
+		return (ranked[bit / 64] >> (bit % 64)) & 1;
+	}
+	return memoized(key, memo_hash(key));
+}
+
+// Called by enqueue() for every map that deepen() walks to
+static void descend(void) {
+	if (anytime_node(&anytime)) {
+		print_result("limit");
+		finish(EXIT_FAILURE);
+	}
+	if (empty_storages < best_empty_storages) {
+		remember_best();
+	}
+
+	// An expanded map was reached along a path that is at least as short, and its successors are all roots already
+	key_map();
+	if (expanded_by_bfs()) {
+		return;
+	}
+	if (path_length == deepening_bound) {
+		cut_off = true;
+		return;
+	}
+	// Every push that's still needed takes at least one move
+	if (use_nearest && path_length + nearest_pushes() > deepening_bound) {
+		cut_off = true;
+		return;
+	}
+
+	u64 hash = fnv_hash(key);
+	struct transposition *t = &transpositions[hash & (transpositions_size - 1)];
+	if (t->iteration == iteration && t->hash == hash && t->path_length <= path_length) {
+		return;
+	}
+	*t = (struct transposition){.hash=hash, .iteration=iteration, .path_length=path_length};
+
+	up();
+	down();
+	left();
+	right();
+}
+
+// Carries on from the maps in the queue with iterative deepening, once --hybrid's memory is used up
+// A shortest solution leaves the expanded maps through a map that is still in the queue, with a path just as long as its own,
+// since the queue only ever holds maps of the last two depths. So deepening every root to the same path length,
+// one longer every iteration, still finds a shortest solution first
+static void deepen(void) {
+	size_t key_size = key_format.length + 1;
+	size_t roots = 0;
+	size_t shallowest = SIZE_MAX;
+	for (size_t i = queue_start_index; i != queue_end_index; i = (i + 1) % QUEUE_LENGTH) {
+		size_t length = strlen(queue[i] + key_size);
+		shallowest = length < shallowest ? length : shallowest;
+		roots++;
+	}
+	if (roots == 0) {
+		return;
+	}
+	printf("hybrid: %zu MiB in use at depth %zu, so deepening from the %zu maps in the queue\n", anytime_rss() >> 20, shallowest, roots);
+
+	if (!transpositions) {
+		transpositions = pages_map(&pages, transpositions_size * sizeof(*transpositions));
+	}
+	deepening = true;
+	cut_off = true;
+	for (deepening_bound = shallowest + 1; cut_off; deepening_bound++) {
+		perf_next_depth(deepening_bound - 1);
+		printf("Depth %zu\n", deepening_bound);
+		print_bfs_stats();
+
+		iteration++;
+		cut_off = false;
+		for (size_t i = queue_start_index; i != queue_end_index; i = (i + 1) % QUEUE_LENGTH) {
+			path_length = strlen(queue[i] + key_size);
+			memcpy(path, queue[i] + key_size, path_length);
+			unkey_map(queue[i]);
+			descend();
+		}
+	}
+	deepening = false;
+}
+
+static size_t state_empty_storages(const u64 *state) {
+	size_t empty = 0;
+	for (size_t w = 0; w < state_words; w++) {
+		empty += __builtin_popcountll(storage_words[w] & ~state[w]);
+	}
+	return empty;
+}
+
+// Layers don't keep paths, so the best state's path is only reconstructed once a limit is hit
+static u64 best_state[MAX_STATE_WORDS];
+static size_t best_depth;
+
+static void print_layers_result(const char *status) {
+	reconstruct_path(best_state, best_depth);
+	unpack_map(best_state);
+	remember_best();
+	print_result(status);
+}
+
+// --partitions: the layers split over processes, where every state belongs to the process that it hashes to,
+// so that the layers, which are what a big level runs out of memory on, are spread over all of them.
+// Every process expands the states of its own layer, and sends every successor to the process it belongs to,
+// in batches over a socket per pair of processes, while it reads the batches that the others send it.
+// Messages are only u64s with explicit lengths, so the same protocol could run over TCP between hosts.
+// At the end of every layer the processes tell each other how it went, and once one of them solved the level,
+// hit a limit, or every layer ran empty, the process with the best state walks back its path,
+// by asking the other processes whether the states it could've come from are in their layers
+
+#define MAX_PARTITIONS 64
+#define PARTITION_BATCH 4096 // Successors that are gathered for another process before they're sent
+#define PARTITION_READ_SIZE 65536
+
+enum message_kind {
+	MESSAGE_STATES, // Followed by count states of the next layer
+	MESSAGE_LAYER_DONE, // Every successor of the layer was sent
+	MESSAGE_QUERY, // Followed by a state, which is asked whether it's in layer depth
+	MESSAGE_ANSWER, // count is 1 if it was
+	MESSAGE_DONE, // The search is over, and count is the exit status
+};
+
+struct message {
+	u64 kind;
+	u64 depth;
+	u64 count;
+
+	// Only for MESSAGE_LAYER_DONE
+	u64 layer_size; // Of the layer that was expanded
+	u64 best_empty_storages;
+	u64 limit; // 1 + the index in limit_names of the limit that was hit, or 0
+	u64 nodes; // Of the sender, so far
+	u64 max_rss; // Of the sender, in KiB
+};
+
+// The connection to another process
+struct peer {
+	int fd;
+
+	u64 *batch; // Successors that aren't sent yet
+	size_t batch_size;
+
+	char *out; // Bytes that the socket didn't take yet
+	size_t out_start;
+	size_t out_size;
+	size_t out_capacity;
+
+	char *in; // Bytes that aren't handled yet
+	size_t in_size;
+	size_t in_capacity;
+
+	bool closed; // Which is only fine once the search is over
+	bool layer_done; // Then the messages after it are of the next layer, so they wait
+	struct message done;
+	bool answered;
+	bool answer;
+};
+
+static struct peer peers[MAX_PARTITIONS];
+static const char *const limit_names[] = {"max-nodes", "timeout", "max-memory"};
+
+static size_t next_size;
+static size_t next_capacity;
+
+static void grow_next_layer(void) {
+	next_capacity *= 2;
+	next_layer = realloc(next_layer, next_capacity * state_words * sizeof(u64));
+	if (!next_layer) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void add_to_next_layer(const u64 *state) {
+	if (next_size == next_capacity) {
+		grow_next_layer();
+	}
+	memcpy(next_layer + next_size++ * state_words, state, state_words * sizeof(u64));
+}
+
+static size_t partition_of(const u64 *state) {
+	if (partitions == 1) {
+		return 0;
+	}
+	u64 h = 0;
+	for (size_t w = 0; w < state_words; w++) {
+		h = (h ^ state[w]) * 0x9E3779B97F4A7C15ull;
+	}
+	return (h ^ (h >> 32)) % partitions;
+}
+
+static char *grow(char *buffer, size_t *capacity, size_t size) {
+	if (size <= *capacity) {
+		return buffer;
+	}
+	while (*capacity < size) {
+		*capacity = *capacity > 0 ? 2 * *capacity : PARTITION_READ_SIZE;
+	}
+	buffer = realloc(buffer, *capacity);
+	if (!buffer) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	return buffer;
+}
+
+static void send_message(size_t to, const struct message *m, const u64 *states) {
+	struct peer *p = &peers[to];
+	size_t states_size = (m->kind == MESSAGE_STATES || m->kind == MESSAGE_QUERY ? m->count : 0) * state_words * sizeof(u64);
+	p->out = grow(p->out, &p->out_capacity, p->out_size + sizeof(*m) + states_size);
+	memcpy(p->out + p->out_size, m, sizeof(*m));
+	if (states) {
+		memcpy(p->out + p->out_size + sizeof(*m), states, states_size);
+	}
+	p->out_size += sizeof(*m) + states_size;
+}
+
+// The first process waits for the others, so that it exits last, with the status of the search
+static void leave_partitions(int status) {
+	if (partition == 0) {
+		while (wait(NULL) > 0) {}
+	}
+	exit(status);
+}
+
+static void handle_message(size_t from, const struct message *m, const u64 *states) {
+	struct peer *p = &peers[from];
+	if (m->kind == MESSAGE_STATES) {
+		for (size_t i = 0; i < m->count; i++) {
+			add_to_next_layer(states + i * state_words);
+		}
+	} else if (m->kind == MESSAGE_LAYER_DONE) {
+		p->layer_done = true;
+		p->done = *m;
+	} else if (m->kind == MESSAGE_QUERY) {
+		bool found = m->depth < layers_size && layer_contains(&layers[m->depth], states);
+		send_message(from, &(struct message){.kind=MESSAGE_ANSWER, .count=found}, NULL);
+	} else if (m->kind == MESSAGE_ANSWER) {
+		p->answered = true;
+		p->answer = m->count;
+	} else {
+		leave_partitions(m->count);
+	}
+}
+
+// Handles the messages that arrived in full, up to the end of a layer
+static void handle_messages(size_t from) {
+	struct peer *p = &peers[from];
+	size_t handled = 0;
+	while (!p->layer_done && p->in_size - handled >= sizeof(struct message)) {
+		struct message m;
+		memcpy(&m, p->in + handled, sizeof(m));
+		size_t size = sizeof(m) + (m.kind == MESSAGE_STATES || m.kind == MESSAGE_QUERY ? m.count : 0) * state_words * sizeof(u64);
+		if (p->in_size - handled < size) {
+			break;
+		}
+		handle_message(from, &m, (const u64 *)(p->in + handled + sizeof(m))); // Messages are whole u64s, so the states are aligned
+		handled += size;
+	}
+	// Nothing may have arrived yet, when p->in is still NULL
+	if (handled > 0) {
+		memmove(p->in, p->in + handled, p->in_size - handled);
+		p->in_size -= handled;
+	}
+}
+
+// Sends and receives whatever the sockets let through, and waits until at least one of them does if wait is set
+static void pump(bool wait) {
+	struct pollfd fds[MAX_PARTITIONS];
+	size_t ids[MAX_PARTITIONS];
+	size_t fds_size = 0;
+	for (size_t i = 0; i < partitions; i++) {
+		if (i == partition) {
+			continue;
+		}
+		handle_messages(i);
+		struct peer *p = &peers[i];
+		if (!p->closed) {
+			fds[fds_size] = (struct pollfd){.fd=p->fd, .events=(p->layer_done ? 0 : POLLIN) | (p->out_size > p->out_start ? POLLOUT : 0)};
+			ids[fds_size++] = i;
+		}
+	}
+	if (fds_size == 0) {
+		fprintf(stderr, "Partition %zu lost every other partition\n", partition);
+		exit(EXIT_FAILURE);
+	}
+
+	if (poll(fds, fds_size, wait ? -1 : 0) < 0) {
+		if (errno == EINTR) {
+			return;
+		}
+		perror("poll");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t j = 0; j < fds_size; j++) {
+		struct peer *p = &peers[ids[j]];
+		if (fds[j].revents & POLLOUT) {
+			ssize_t written = write(p->fd, p->out + p->out_start, p->out_size - p->out_start);
+			if (written > 0) {
+				p->out_start += written;
+			}
+			if (written < 0 && errno == EPIPE) {
+				p->closed = true;
+			}
+			if (p->out_start == p->out_size || p->closed) {
+				p->out_start = 0;
+				p->out_size = 0;
+			}
+		}
+		if (fds[j].revents & (POLLIN | POLLHUP | POLLERR)) {
+			p->in = grow(p->in, &p->in_capacity, p->in_size + PARTITION_READ_SIZE);
+			ssize_t received = read(p->fd, p->in + p->in_size, PARTITION_READ_SIZE);
+			if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+				p->closed = true;
+			}
+			if (received > 0) {
+				p->in_size += received;
+				handle_messages(ids[j]);
+			}
+		}
+	}
+}
+
+static bool sending(void) {
+	for (size_t i = 0; i < partitions; i++) {
+		if (i != partition && peers[i].out_size > peers[i].out_start) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void flush_batch(size_t to) {
+	struct peer *p = &peers[to];
+	if (p->batch_size > 0) {
+		send_message(to, &(struct message){.kind=MESSAGE_STATES, .count=p->batch_size}, p->batch);
+		p->batch_size = 0;
+	}
+}
+
+static void send_successor(size_t to, const u64 *state) {
+	struct peer *p = &peers[to];
+	memcpy(p->batch + p->batch_size++ * state_words, state, state_words * sizeof(u64));
+	if (p->batch_size == PARTITION_BATCH) {
+		flush_batch(to);
+		pump(false);
+	}
+}
+
+// A process that exits before the search is over crashed, or got killed
+static void check_closed(size_t i) {
+	if (peers[i].closed) {
+		fprintf(stderr, "Partition %zu lost partition %zu\n", partition, i);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Whether the state is in layer k of whichever process it belongs to
+static bool in_layer(size_t k, const u64 *state) {
+	size_t owner = partition_of(state);
+	if (owner == partition) {
+		return layer_contains(&layers[k], state);
+	}
+	struct peer *p = &peers[owner];
+	send_message(owner, &(struct message){.kind=MESSAGE_QUERY, .depth=k, .count=1}, state);
+	p->answered = false;
+	while (!p->answered) {
+		check_closed(owner);
+		pump(true);
+	}
+	return p->answer;
+}
+
+// Ends the search for every process
+static void exit_partitions(int status) {
+	fflush(stdout);
+	for (size_t i = 0; i < partitions; i++) {
+		if (i != partition) {
+			send_message(i, &(struct message){.kind=MESSAGE_DONE, .count=status}, NULL);
+		}
+	}
+	while (sending()) {
+		pump(true);
+	}
+	leave_partitions(status);
+}
+
+// Connects every pair of processes with a socket, and forks the others
+static void start_partitions(void) {
+	int sockets[MAX_PARTITIONS][MAX_PARTITIONS];
+	partitioned = true;
+	for (size_t i = 0; i < partitions; i++) {
+		for (size_t j = i + 1; j < partitions; j++) {
+			int pair[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+				perror("socketpair");
+				exit(EXIT_FAILURE);
+			}
+			sockets[i][j] = pair[0];
+			sockets[j][i] = pair[1];
+		}
+	}
+
+	fflush(stdout);
+	signal(SIGPIPE, SIG_IGN); // Processes exit once the search is over, while the others may still be writing to them
+	for (size_t i = 1; i < partitions; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			// Don't leave partitions running when the first one gets killed
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			partition = i;
+			perf.enabled = false;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < partitions; i++) {
+		for (size_t j = 0; j < partitions; j++) {
+			if (i == j) {
+				continue;
+			}
+			if (i != partition) {
+				close(sockets[i][j]);
+			} else {
+				peers[j].fd = sockets[i][j];
+				fcntl(peers[j].fd, F_SETFL, O_NONBLOCK);
+				peers[j].batch = malloc(PARTITION_BATCH * state_words * sizeof(u64));
+			}
+		}
 	}
 }
 
-int main(void) {
-	size_t n = 1;
-	char *line = malloc(n);
-	while (getline(&line, &n, stdin) > 0) {
-		if (line[0] == '%' || isspace(line[0])) { // If this line is a comment or whitespace
+// Sends the rest of the layer, and the limit that was hit, if any, and waits for the rest from the others
+// Returns false once every layer ran empty, and only returns otherwise if the search goes on
+static bool exchange_layer(size_t depth, size_t layer_size) {
+	u64 limit = 0;
+	for (size_t i = 0; anytime.limit && i < sizeof(limit_names) / sizeof(limit_names[0]); i++) {
+		limit = strcmp(anytime.limit, limit_names[i]) == 0 ? i + 1 : limit;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	struct message done = {.kind=MESSAGE_LAYER_DONE, .depth=depth, .layer_size=layer_size, .best_empty_storages=best_empty_storages, .limit=limit,
+		.nodes=anytime.nodes, .max_rss=usage.ru_maxrss};
+	for (size_t i = 0; i < partitions; i++) {
+		if (i != partition) {
+			flush_batch(i);
+			send_message(i, &done, NULL);
+		}
+	}
+
+	bool waiting = true;
+	while (waiting || sending()) {
+		pump(true);
+		waiting = false;
+		for (size_t i = 0; i < partitions; i++) {
+			if (i != partition && !peers[i].layer_done) {
+				check_closed(i);
+				waiting = true;
+			}
+		}
+	}
+
+	// Every process comes to the same conclusions, from the same messages
+	size_t total = layer_size;
+	size_t largest = layer_size;
+	size_t best = partition;
+	u64 best_empty = best_empty_storages;
+	size_t other_nodes = 0;
+	anytime.other_rss = 0;
+	for (size_t i = 0; i < partitions; i++) {
+		if (i == partition) {
 			continue;
 		}
+		const struct message *m = &peers[i].done;
+		peers[i].layer_done = false;
+		total += m->layer_size;
+		other_nodes += m->nodes;
+		anytime.other_rss += m->max_rss;
+		largest = m->layer_size > largest ? m->layer_size : largest;
+		limit = limit ? limit : m->limit;
+		if (m->best_empty_storages < best_empty || (m->best_empty_storages == best_empty && i < best)) {
+			best_empty = m->best_empty_storages;
+			best = i;
+		}
+	}
+
+	if (partition == 0 && depth > 0) {
+		printf("Depth %zu\n", depth);
+		printf("layer size: %zu\n", total);
+		printf("partitions: the largest of %zu has %zu states\n", partitions, largest);
+		print_bfs_stats();
+		fflush(stdout);
+	}
+
+	if (best_empty > 0 && limit == 0 && total > 0) {
+		return true;
+	}
+	if (best != partition) {
+		// Answers the queries of the process with the best state, until it's done
+		while (true) {
+			pump(true);
+		}
+	}
+	// The result is of the search as a whole, so it has the nodes and memory of every process
+	anytime.nodes += other_nodes;
+	if (best_empty == 0) {
+		reconstruct_path(best_state, best_depth);
+		unpack_map(best_state);
+		check_is_solved();
+	}
+	if (limit != 0) {
+		anytime.limit = limit_names[limit - 1];
+		print_layers_result("limit");
+		finish(EXIT_FAILURE);
+	}
+	return false;
+}
+
+static void solve_layers(void) {
+	if (partitions > 1) {
+		start_partitions();
+	}
+
+	next_capacity = 1;
+	next_layer = malloc(next_capacity * state_words * sizeof(u64));
+	layers[0].states = malloc(state_words * sizeof(u64));
+	layers_size = 1;
+	pack_map(layers[0].states);
+	memcpy(best_state, layers[0].states, state_words * sizeof(u64));
+	best_depth = 0;
+	layers[0].size = partition_of(best_state) == partition; // With --partitions, the start is in a single process's layer
+
+	perf_begin(&perf, anytime.nodes);
+	for (size_t depth = 0; partitions > 1 || layers[depth].size > 0; depth++) {
+		if (depth + 1 == MAX_PATH_LENGTH) {
+			fprintf(stderr, "The path is too long! You need to up the MAX_PATH_LENGTH #define\n");
+			print_layers_result("error");
+			finish(EXIT_FAILURE);
+		}
+
+		next_size = 0;
+		const struct layer *l = &layers[depth];
+		size_t expanded = 0;
+		for (; expanded < l->size && best_empty_storages > 0 && !anytime.limit; expanded++) {
+			const u64 *state = l->states + expanded * state_words;
+			size_t p = state_player(state);
+
+			size_t empty = state_empty_storages(state);
+			if ((i64)empty < best_empty_storages) {
+				best_empty_storages = empty;
+				memcpy(best_state, state, state_words * sizeof(u64));
+				best_depth = depth;
+			}
+			if (anytime_node(&anytime) && partitions == 1) {
+				print_layers_result("limit");
+				finish(EXIT_FAILURE);
+			}
+			if (partitions > 1 && expanded % PARTITION_BATCH == 0) {
+				pump(false); // So that the others' batches don't pile up in the sockets
+			}
+
+			for (size_t d = 0; d < 4; d++) {
+				size_t n = neighbors[p][d];
+				if (n == NO_FLOOR) {
+					continue;
+				}
+
+				if (next_size == next_capacity) {
+					grow_next_layer();
+				}
+				u64 *successor = next_layer + next_size * state_words;
+				memcpy(successor, state, state_words * sizeof(u64));
+
+				if (state_has_box(state, n)) {
+					size_t target = neighbors[n][d];
+					if (target == NO_FLOOR || state_has_box(state, target) || dead_floors[target]) {
+						continue;
+					}
+					state_flip_box(successor, n);
+					state_flip_box(successor, target);
+					state_set_player(successor, n);
+
+					if (state_is_solved(successor)) {
+						memcpy(best_state, successor, state_words * sizeof(u64));
+						best_depth = depth + 1;
+						best_empty_storages = 0;
+						if (partitions == 1) {
+							entries_seen += expanded + 1;
+							reconstruct_path(successor, depth + 1);
+							unpack_map(successor);
+							check_is_solved();
+						}
+					}
+				} else {
+					state_set_player(successor, n);
+				}
+
+				size_t owner = partition_of(successor);
+				if (owner == partition) {
+					next_size++;
+				} else {
+					send_successor(owner, successor); // Which can move next_layer
+				}
+			}
+		}
+		entries_seen += expanded;
+
+		if (partitions > 1 && !exchange_layer(depth, l->size)) {
+			break;
+		}
+
+		u64 *scratch = malloc((next_size + 1) * state_words * sizeof(u64));
+		if (!scratch) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		radix_sort(next_layer, scratch, next_size);
+		free(scratch);
+
+		next_size = deduplicate(next_layer, next_size);
+		for (size_t k = 0; k <= depth; k++) {
+			next_size = subtract(next_layer, next_size, &layers[k]);
+		}
+
+		layers[depth + 1].states = malloc((next_size + 1) * state_words * sizeof(u64));
+		memcpy(layers[depth + 1].states, next_layer, next_size * state_words * sizeof(u64));
+		layers[depth + 1].size = next_size;
+		layers_size = depth + 2;
+
+		perf_next_depth(depth);
+		path_length = depth + 1;
+		if (partitions == 1) {
+			printf("Depth %zu\n", path_length);
+			printf("layer size: %zu\n", next_size);
+			print_bfs_stats();
+		}
+	}
+
+	free(next_layer);
+	next_layer = NULL;
+}
+
+// Clears whatever the previous level left behind, while keeping the memory that was already faulted in
+static void reset(void) {
+	memset(map, 0, sizeof(map));
+	memset(frozen, 0, sizeof(frozen));
+	width = 0;
+	height = 0;
+	player_x = 0;
+	player_y = 0;
+	origin_x = 0;
+	origin_y = 0;
+	empty_storages = 0;
+	entries_seen = 0;
+	path_length = 0;
+
+	maps_size = 0;
+	map_strings_size = 0;
+	if (++generation == 0) {
+		memset(bucket_generations, 0, MAX_MAPS * sizeof(u32));
+		generation = 1;
+	}
+
+	if (bitstate && bitstate_bits_set > 0) {
+		memset(bitstate, 0, bitstate_bits / 8);
+	}
+	bitstate_bits_set = 0;
+	expected_omissions = 0;
+
+	if (ranked) {
+		pages_unmap(&pages, ranked, ranked_size);
+		ranked = NULL;
+	}
+
+	while (queue_start_index != queue_end_index) {
+		free(queue[queue_start_index++]);
+		queue_start_index %= QUEUE_LENGTH;
+	}
+	queue_start_index = 0;
+	queue_end_index = 0;
+
+	floors_size = 0;
+	memset(storage_words, 0, sizeof(storage_words));
+	for (size_t i = 0; i < layers_size; i++) {
+		free(layers[i].states);
+	}
+	layers_size = 0;
+	free(next_layer);
+	next_layer = NULL;
+
+	deepening = false;
+
+	best_empty_storages = 0;
+	best_path_length = 0;
+	from_cache = false;
+	anytime.nodes = 0;
+	anytime.limit = NULL;
+	anytime_start(&anytime);
+}
 
-		size_t len = 0;
-		while (line[len] != '\n') {
-			char c = line[len];
+// Reads the rows of a level into the map
+static void read_level(const struct level *level) {
+	perf_begin(&perf, 0);
+
+	const char *cursor = level->start;
+	char row[MAX_WIDTH];
+	size_t len;
+	while (level_next_row(level, &cursor, row, MAX_WIDTH, &len)) {
+		for (size_t x = 0; x < len && x < MAX_WIDTH && height < MAX_HEIGHT; x++) {
+			char c = row[x];
 			if (c == '@' || c == '+') {
-				player_x = len;
+				player_x = x;
 				player_y = height;
 				if (c == '+') {
 					empty_storages++;
-					map[height][len] = STORAGE;
+					map[height][x] = STORAGE;
 				}
 			} else {
 				enum tile t = char_to_tile(c);
 				if (t == STORAGE) {
 					empty_storages++;
 				}
-				map[height][len] = t;
+				map[height][x] = t;
 			}
-			len++;
 		}
 		width = len > width ? len : width;
-		if (width > MAX_WIDTH) {
-			fprintf(stderr, "The map exceeds MAX_WIDTH\n");
-			exit(EXIT_FAILURE);
-		}
 		height++;
-		if (height > MAX_HEIGHT) {
-			fprintf(stderr, "The map exceeds MAX_HEIGHT\n");
-			exit(EXIT_FAILURE);
+	}
+
+	if (width > MAX_WIDTH || height > MAX_HEIGHT) {
+		fprintf(stderr, "The map exceeds %s\n", width > MAX_WIDTH ? "MAX_WIDTH" : "MAX_HEIGHT");
+		print_result("error");
+		finish(EXIT_FAILURE);
+	}
+}
+
+// Replays a cached solution onto the map, so that a hit prints the solved map like a search would
+// Returns false and leaves the map alone when the path doesn't solve the level
+static bool replay_cached_path(const char *cached_path) {
+	static enum tile replayed[MAX_HEIGHT][MAX_WIDTH];
+	memcpy(replayed, map, sizeof(map));
+	struct preprocess p = {.map=replayed, .frozen=frozen, .width=width, .height=height, .player_x=player_x, .player_y=player_y};
+	for (const char *c = cached_path; *c != '\0'; c++) {
+		char move = tolower(*c);
+		if (!preprocess_replay_move(&p, move == 'l' ? -1 : move == 'r', move == 'u' ? -1 : move == 'd', isupper(*c))) {
+			return false;
+		}
+	}
+	if (preprocess_empty_storages(&p) > 0) {
+		return false;
+	}
+	memcpy(map, replayed, sizeof(map));
+	player_x = p.player_x;
+	player_y = p.player_y;
+	empty_storages = 0;
+	return true;
+}
+
+static void solve_level(void) {
+	anytime_start(&anytime);
+
+	preprocess();
+	perf_end(&perf, "parse", 0);
+	best_empty_storages = empty_storages;
+
+	if (cache.path) {
+		char *map_string = stringify_map();
+		cache.key = cache_hash(map_string);
+		free(map_string);
+
+		char *cached_path;
+		const char *status = cache_lookup(&cache, &cached_path);
+		// An entry that was cut off, mangled, or doesn't solve the level is treated as a miss, rather than overrunning path
+		if (status && (strlen(cached_path) >= MAX_PATH_LENGTH || cached_path[strspn(cached_path, "udlrUDLR")] != '\0' || (strcmp(status, "solved") == 0 && !replay_cached_path(cached_path)))) {
+			printf("cache: ignoring the level's path in '%s', which is malformed or doesn't solve it\n", cache.path);
+			free(cached_path);
+			status = NULL;
+		}
+		if (status) {
+			printf("cache: found the level in '%s'\n", cache.path);
+			from_cache = true;
+			path_length = strlen(cached_path);
+			memcpy(path, cached_path, path_length);
+			free(cached_path);
+
+			if (strcmp(status, "solved") == 0) {
+				printf("Solved!\n");
+				print_map();
+				print_result("solved");
+				finish(EXIT_SUCCESS);
+			}
+			fprintf(stderr, "No solution was found :(\n");
+			print_result("unsolved");
+			finish(EXIT_FAILURE);
 		}
 	}
-	free(line);
 
 	print_map();
 	check_is_solved();
 
-	memset(buckets, UINT32_MAX, MAX_MAPS * sizeof(u32));
+	init_distances();
+	init_floors();
+
+	if (use_layers) {
+		solve_layers();
+		print_bfs_stats();
+
+		fprintf(stderr, "No solution was found :(\n");
+		print_layers_result("unsolved");
+		finish(EXIT_FAILURE);
+	}
+
+	if (!bitstate) {
+		init_ranking();
+	}
 	enqueue(1);
 	solve();
 	print_bfs_stats();
 
 	fprintf(stderr, "No solution was found :(\n");
-	exit(EXIT_FAILURE);
+	print_result("unsolved");
+	finish(EXIT_FAILURE);
+}
+
+// Solves the levels from fd one after another, writing a result line for each of them to out
+static void serve(int fd, FILE *out) {
+	results = out;
+	levels_served = 0; // Every connection numbers its own levels
+	struct levels collection;
+	levels_open(&collection, fd);
+	for (size_t i = 0; i < collection.levels_size; i++) {
+		reset();
+		levels_served++;
+		if (setjmp(level_done) == 0) {
+			read_level(&collection.levels[i]);
+			solve_level();
+		}
+	}
+	levels_close(&collection);
+}
+
+// Every worker accepts connections from the same socket, and keeps its own warm tables across all of them,
+// so that as many levels get solved at once as there are workers
+static void serve_socket(const char *socket_path, size_t workers) {
+	struct sockaddr_un address = {.sun_family=AF_UNIX};
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "The socket path is too long\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "Listening on '%s' with %zu workers\n", socket_path, workers);
+
+	for (size_t i = 1; i < workers; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			// Don't leave workers running when the server itself gets killed
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			break;
+		}
+	}
+
+	// A client that hangs up early mustn't kill the worker
+	signal(SIGPIPE, SIG_IGN);
+
+	while (true) {
+		int connection = accept(listener, NULL, NULL);
+		if (connection < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("accept");
+			exit(EXIT_FAILURE);
+		}
+
+		FILE *out = fdopen(connection, "w");
+		serve(connection, out);
+		fclose(out);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	size_t bitstate_mebibytes = 0;
+	size_t hybrid_mebibytes = 0;
+	const char *socket_path = NULL;
+	size_t workers = 1;
+	size_t level_number = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--layers") == 0) {
+			use_layers = true;
+		} else if (strcmp(argv[i], "--bitstate") == 0 && i + 1 < argc) {
+			bitstate_mebibytes = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--bitstate-hashes") == 0 && i + 1 < argc) {
+			bitstate_hashes = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			cache.path = argv[++i];
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			perf_open(&perf);
+		} else if (strcmp(argv[i], "--serve") == 0) {
+			serving = true;
+		} else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+			socket_path = argv[++i];
+			serving = true;
+		} else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			workers = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+			batch_size = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--hybrid") == 0 && i + 1 < argc) {
+			hybrid_mebibytes = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+			level_number = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--partitions") == 0 && i + 1 < argc) {
+			partitions = strtoull(argv[++i], NULL, 10);
+			use_layers = true;
+		} else if (!anytime_parse(&anytime, argc, argv, &i)) {
+			fprintf(stderr, "Usage: %s [--layers [--partitions n] | --bitstate MiB [--bitstate-hashes k] | --hybrid MiB] [--max-nodes n] [--timeout seconds] [--max-memory MiB] [--serve | --socket path [--workers n]] [--batch k] [--level n] [--cache path] [--perf] < levels.txt\n", argv[0]);
+			fprintf(stderr, "--hybrid gives its transpositions an eighth of MiB, but at least 1 MiB, so a small MiB deepens sooner, but without searching the same maps over and over\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (batch_size == 0 || batch_size > MAX_BATCH) {
+		fprintf(stderr, "--batch has to be between 1 and %d\n", MAX_BATCH);
+		exit(EXIT_FAILURE);
+	}
+	if (partitions == 0 || partitions > MAX_PARTITIONS || (partitions > 1 && (serving || bitstate_mebibytes > 0))) {
+		fprintf(stderr, "--partitions has to be between 1 and %d, and can't be combined with serving or --bitstate\n", MAX_PARTITIONS);
+		exit(EXIT_FAILURE);
+	}
+
+	if (hybrid_mebibytes > 0) {
+		if (use_layers || bitstate_mebibytes > 0) {
+			fprintf(stderr, "--hybrid needs the memo table to prune with, so it can't be combined with --layers or --bitstate\n");
+			exit(EXIT_FAILURE);
+		}
+		hybrid_memory = hybrid_mebibytes << 20;
+		for (transpositions_size = TRANSPOSITIONS_MIN_SIZE; 2 * transpositions_size * sizeof(struct transposition) <= hybrid_memory / 8; transpositions_size *= 2) {}
+		size_t transpositions_memory = transpositions_size * sizeof(struct transposition);
+		hybrid_memory = hybrid_memory > transpositions_memory ? hybrid_memory - transpositions_memory : 1; // Not 0, which is no --hybrid
+	}
+
+	if (bitstate_mebibytes > 0) {
+		allocate_bitstate(bitstate_mebibytes);
+	} else if (!use_layers) {
+		allocate_tables();
+	}
+
+	if (use_layers) {
+		snprintf(cache.variant, sizeof(cache.variant), "bfs-layers");
+	} else if (bitstate) {
+		snprintf(cache.variant, sizeof(cache.variant), "bfs-bitstate-%zu-%zu", bitstate_mebibytes, bitstate_hashes);
+	} else {
+		snprintf(cache.variant, sizeof(cache.variant), "bfs");
+	}
+
+	if (serving) {
+		// Only the result lines are written, while the usual output of every level is thrown away
+		FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+		if (!out || !freopen("/dev/null", "w", stdout)) {
+			perror("freopen");
+			exit(EXIT_FAILURE);
+		}
+
+		if (socket_path) {
+			serve_socket(socket_path, workers > 0 ? workers : 1);
+		}
+		serve(STDIN_FILENO, out);
+		exit(EXIT_SUCCESS);
+	}
+
+	anytime_start(&anytime);
+	struct levels collection;
+	if (!levels_open(&collection, STDIN_FILENO) || level_number == 0 || level_number > collection.levels_size) {
+		fprintf(stderr, "--level has to be between 1 and the %zu levels of the input\n", collection.levels_size);
+		exit(EXIT_FAILURE);
+	}
+	levels_print(&collection, level_number);
+	read_level(&collection.levels[level_number - 1]);
+	solve_level();
 }
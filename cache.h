@@ -0,0 +1,97 @@
+// A cache of solutions and proven-unsolvable verdicts, so that a level that was already solved is never searched again
+//
+// The key is a hash of the level after preprocessing, which drops comments, the floor outside of the walls,
+// and the difference between the ways a box or player on a storage can be written.
+// Every entry is a single line that is appended to a text file:
+//
+// 0123456789abcdef variant=bfs max_nodes=0 timeout=0 max_memory_mib=0 status=solved moves=85 path=ruuLLL...
+//
+// The limits are only stored for reference, since a solution or a proof that there is none doesn't depend on them,
+// which is also why runs that hit a limit are never stored
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "anytime.h"
+
+#define CACHE_MAX_VARIANT_LENGTH 64
+
+struct cache {
+	const char *path; // NULL if caching is off
+	char variant[CACHE_MAX_VARIANT_LENGTH]; // The solver and whatever options change its results
+	uint64_t key;
+};
+
+// FNV-1a
+static uint64_t cache_hash(const char *level) {
+	uint64_t h = 0xcbf29ce484222325;
+	for (const unsigned char *c = (const unsigned char *)level; *c; c++) {
+		h = (h ^ *c) * 0x100000001b3;
+	}
+	return h;
+}
+
+// Looks up the level's entry, and returns its status, or NULL if there is none
+// The path is returned with malloc(), and has to be freed
+static const char *cache_lookup(const struct cache *c, char **path) {
+	static char status[16];
+
+	FILE *f = c->path ? fopen(c->path, "r") : NULL;
+	if (!f) {
+		return NULL;
+	}
+	flock(fileno(f), LOCK_SH);
+
+	bool found = false;
+	size_t n = 0;
+	char *line = NULL;
+	while (!found && getline(&line, &n, f) > 0) {
+		char key[17];
+		char variant[CACHE_MAX_VARIANT_LENGTH];
+		int path_offset = -1;
+		if (sscanf(line, "%16s variant=%63s %*s %*s %*s status=%15s moves=%*u path=%n", key, variant, status, &path_offset) != 3 || path_offset < 0) {
+			continue;
+		}
+		if (strtoull(key, NULL, 16) != c->key || strcmp(variant, c->variant) != 0) {
+			continue;
+		}
+
+		line[strcspn(line, "\n")] = '\0';
+		*path = strdup(line + path_offset);
+		found = true;
+	}
+	free(line);
+
+	fclose(f);
+	return found ? status : NULL;
+}
+
+static void cache_store(const struct cache *c, const struct anytime *a, const char *status, size_t moves, const char *path) {
+	if (!c->path) {
+		return;
+	}
+
+	int fd = open(c->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		perror("open");
+		return;
+	}
+
+	// Other solvers may be appending to the same cache at the same time
+	flock(fd, LOCK_EX);
+	dprintf(fd, "%016" PRIx64 " variant=%s max_nodes=%zu timeout=%g max_memory_mib=%zu status=%s moves=%zu path=%s\n",
+		c->key, c->variant, a->max_nodes, a->timeout, a->max_memory >> 20, status, moves, path);
+	close(fd);
+}
+
+#endif
@@ -0,0 +1,352 @@
+// Deadlock patterns that are learned during the search
+//
+// When the search finishes a subtree without ever running into the depth limit, the map at its root is deadlocked.
+// Most of its boxes usually have nothing to do with that, so they are removed one by one,
+// as long as a small search without the removed boxes still can't get every remaining box onto a storage.
+// Removing boxes only makes a map easier, so any map that contains the remaining boxes is deadlocked as well,
+// as long as the player is in the same area
+//
+// Tiles are numbered x + y * stride, so sets of tiles are bitsets
+// Only the words that the map's tiles need are used, so a small map doesn't pay for DEADLOCK_SQUARES
+
+#ifndef DEADLOCK_H
+#define DEADLOCK_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEADLOCK_SQUARES 4096
+#define DEADLOCK_WORDS (DEADLOCK_SQUARES / 64)
+#define DEADLOCK_MAX_PATTERNS 65536
+#define DEADLOCK_MAX_ENTRIES (DEADLOCK_MAX_PATTERNS * 4)
+#define DEADLOCK_SEARCH_LIMIT 1024 // States a search may visit before giving up on proving a deadlock
+#define DEADLOCK_MAGIC "SOKODEAD"
+#define DEADLOCK_VERSION 2
+
+struct deadlock_pattern {
+	uint64_t boxes[DEADLOCK_WORDS];
+	uint64_t area[DEADLOCK_WORDS]; // Where the player has to be for the pattern to be deadlocked
+};
+
+// A pattern that contains a tile, which is how patterns are looked up after a box gets pushed onto that tile
+struct deadlock_entry {
+	uint32_t pattern;
+	uint32_t next;
+};
+
+struct deadlock_state {
+	uint64_t boxes[DEADLOCK_WORDS];
+	uint32_t player; // The top-left tile of the player's area
+	uint32_t search; // The search that this slot of seen was filled in, so it doesn't need to be cleared between searches
+};
+
+struct deadlocks {
+	size_t stride;
+	size_t squares; // The tiles of the map, which is stride times its height
+	size_t words; // The words that squares bits take up
+	uint64_t walls[DEADLOCK_WORDS];
+	uint64_t storages[DEADLOCK_WORDS];
+	uint64_t dead[DEADLOCK_WORDS]; // Tiles from which a box can't be pushed onto any storage
+
+	// The boxes and then the area of every pattern, words long each, so that patterns of small maps are packed together
+	uint64_t patterns[DEADLOCK_MAX_PATTERNS * 2 * DEADLOCK_WORDS];
+	size_t patterns_size;
+
+	// Index 0 is never used, so that a 0 can mean "end of list"
+	uint32_t heads[DEADLOCK_SQUARES];
+	struct deadlock_entry entries[DEADLOCK_MAX_ENTRIES];
+	size_t entries_size;
+
+	size_t learned;
+	size_t matched;
+
+	// Scratch space of the searches that try to remove boxes
+	struct deadlock_state seen[DEADLOCK_SEARCH_LIMIT * 2];
+	struct deadlock_state queue[DEADLOCK_SEARCH_LIMIT];
+	uint32_t searches;
+};
+
+static bool deadlock_has(const uint64_t *set, size_t tile) {
+	return (set[tile / 64] >> (tile % 64)) & 1;
+}
+
+static void deadlock_add(uint64_t *set, size_t tile) {
+	set[tile / 64] |= (uint64_t)1 << (tile % 64);
+}
+
+static void deadlock_remove(uint64_t *set, size_t tile) {
+	set[tile / 64] &= ~((uint64_t)1 << (tile % 64));
+}
+
+static uint64_t *deadlock_pattern_boxes(struct deadlocks *d, size_t pattern) {
+	return d->patterns + pattern * 2 * d->words;
+}
+
+static uint64_t *deadlock_pattern_area(struct deadlocks *d, size_t pattern) {
+	return d->patterns + (pattern * 2 + 1) * d->words;
+}
+
+// squares has to be at most DEADLOCK_SQUARES
+static void deadlock_init(struct deadlocks *d, size_t stride, size_t squares, const uint64_t *walls, const uint64_t *storages, const uint64_t *dead) {
+	d->stride = stride;
+	d->squares = squares;
+	d->words = (squares + 63) / 64;
+	memcpy(d->walls, walls, sizeof(d->walls));
+	memcpy(d->storages, storages, sizeof(d->storages));
+	memcpy(d->dead, dead, sizeof(d->dead));
+	d->patterns_size = 0;
+	d->entries_size = 1;
+	memset(d->heads, 0, squares * sizeof(d->heads[0]));
+}
+
+static bool deadlock_index(struct deadlocks *d, const struct deadlock_pattern *pattern) {
+	size_t boxes = 0;
+	for (size_t w = 0; w < d->words; w++) {
+		boxes += __builtin_popcountll(pattern->boxes[w]);
+	}
+	if (d->patterns_size == DEADLOCK_MAX_PATTERNS || d->entries_size + boxes > DEADLOCK_MAX_ENTRIES) {
+		return false;
+	}
+
+	memcpy(deadlock_pattern_boxes(d, d->patterns_size), pattern->boxes, d->words * sizeof(uint64_t));
+	memcpy(deadlock_pattern_area(d, d->patterns_size), pattern->area, d->words * sizeof(uint64_t));
+	for (size_t tile = 0; tile < d->squares; tile++) {
+		if (deadlock_has(pattern->boxes, tile)) {
+			d->entries[d->entries_size] = (struct deadlock_entry){.pattern=d->patterns_size, .next=d->heads[tile]};
+			d->heads[tile] = d->entries_size++;
+		}
+	}
+	d->patterns_size++;
+
+	return true;
+}
+
+// Only the patterns that contain the box that just got pushed need to be checked,
+// since the map before the push didn't match any of the others
+static bool deadlock_matches(struct deadlocks *d, const uint64_t *boxes, size_t pushed, size_t player) {
+	for (uint32_t e = d->heads[pushed]; e != 0; e = d->entries[e].next) {
+		if (!deadlock_has(deadlock_pattern_area(d, d->entries[e].pattern), player)) {
+			continue;
+		}
+
+		const uint64_t *pattern_boxes = deadlock_pattern_boxes(d, d->entries[e].pattern);
+		bool contained = true;
+		for (size_t w = 0; w < d->words; w++) {
+			contained &= (pattern_boxes[w] & ~boxes[w]) == 0;
+		}
+		if (contained) {
+			d->matched++;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Floods the player's area, and returns its top-left tile
+static size_t deadlock_flood(const struct deadlocks *d, const uint64_t *boxes, size_t player, uint64_t *area) {
+	size_t stack[DEADLOCK_SQUARES];
+	size_t stack_size = 0;
+	size_t top_left = player;
+
+	memset(area, 0, d->words * sizeof(uint64_t));
+	deadlock_add(area, player);
+	stack[stack_size++] = player;
+
+	while (stack_size > 0) {
+		size_t tile = stack[--stack_size];
+		top_left = tile < top_left ? tile : top_left;
+
+		size_t neighbors[4] = {tile - d->stride, tile + d->stride, tile - 1, tile + 1};
+		for (size_t i = 0; i < 4; i++) {
+			size_t n = neighbors[i];
+			if (n < d->squares && !deadlock_has(d->walls, n) && !deadlock_has(boxes, n) && !deadlock_has(area, n)) {
+				deadlock_add(area, n);
+				stack[stack_size++] = n;
+			}
+		}
+	}
+
+	return top_left;
+}
+
+static uint64_t deadlock_hash(const struct deadlocks *d, const struct deadlock_state *s) {
+	uint64_t h = s->player * 0x9E3779B97F4A7C15ull;
+	for (size_t w = 0; w < d->words; w++) {
+		h = (h ^ s->boxes[w]) * 0x9E3779B97F4A7C15ull;
+	}
+	return h ^ (h >> 29);
+}
+
+// Returns whether the state hadn't been seen yet
+static bool deadlock_visit(struct deadlocks *d, const struct deadlock_state *s) {
+	size_t capacity = sizeof(d->seen) / sizeof(d->seen[0]);
+	for (size_t i = deadlock_hash(d, s) % capacity;; i = (i + 1) % capacity) {
+		struct deadlock_state *slot = &d->seen[i];
+		if (slot->search != d->searches) {
+			*slot = *s;
+			slot->search = d->searches;
+			return true;
+		}
+		if (slot->player == s->player && memcmp(slot->boxes, s->boxes, d->words * sizeof(uint64_t)) == 0) {
+			return false;
+		}
+	}
+}
+
+// Searches whether the boxes can all be pushed onto storages with no other boxes around
+// Returns true only if the search ran out of states without managing to do so
+static bool deadlock_proven(struct deadlocks *d, const uint64_t *boxes, size_t player) {
+	if (++d->searches == 0) {
+		memset(d->seen, 0, sizeof(d->seen));
+		d->searches = 1;
+	}
+	size_t queue_start = 0;
+	size_t queue_end = 0;
+
+	struct deadlock_state start;
+	uint64_t area[DEADLOCK_WORDS];
+	memcpy(start.boxes, boxes, d->words * sizeof(uint64_t));
+	start.player = deadlock_flood(d, boxes, player, area);
+	deadlock_visit(d, &start);
+	d->queue[queue_end++] = start;
+
+	while (queue_start < queue_end) {
+		struct deadlock_state s = d->queue[queue_start++];
+
+		bool solved = true;
+		for (size_t w = 0; w < d->words; w++) {
+			solved &= (s.boxes[w] & ~d->storages[w]) == 0;
+		}
+		if (solved) {
+			return false;
+		}
+
+		deadlock_flood(d, s.boxes, s.player, area);
+
+		for (size_t tile = 0; tile < d->squares; tile++) {
+			if (!deadlock_has(area, tile)) {
+				continue;
+			}
+
+			size_t steps[4] = {-d->stride, d->stride, -1, 1};
+			for (size_t i = 0; i < 4; i++) {
+				size_t box = tile + steps[i];
+				size_t target = box + steps[i];
+				if (target >= d->squares || !deadlock_has(s.boxes, box) || deadlock_has(d->walls, target) || deadlock_has(s.boxes, target) || deadlock_has(d->dead, target)) {
+					continue;
+				}
+
+				struct deadlock_state next = s;
+				deadlock_remove(next.boxes, box);
+				deadlock_add(next.boxes, target);
+				uint64_t next_area[DEADLOCK_WORDS];
+				next.player = deadlock_flood(d, next.boxes, box, next_area);
+
+				if (deadlock_visit(d, &next)) {
+					if (queue_end == DEADLOCK_SEARCH_LIMIT) {
+						return false;
+					}
+					d->queue[queue_end++] = next;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Should be called with a map that is known to be deadlocked
+// Returns whether a pattern was learned from it
+static bool deadlock_learn(struct deadlocks *d, const uint64_t *boxes, size_t player) {
+	struct deadlock_pattern pattern;
+	memcpy(pattern.boxes, boxes, d->words * sizeof(uint64_t));
+
+	for (size_t tile = 0; tile < d->squares; tile++) {
+		if (!deadlock_has(pattern.boxes, tile)) {
+			continue;
+		}
+
+		uint64_t fewer[DEADLOCK_WORDS];
+		memcpy(fewer, pattern.boxes, d->words * sizeof(uint64_t));
+		deadlock_remove(fewer, tile);
+
+		if (deadlock_proven(d, fewer, player)) {
+			memcpy(pattern.boxes, fewer, d->words * sizeof(uint64_t));
+		}
+	}
+
+	deadlock_flood(d, pattern.boxes, player, pattern.area);
+
+	if (!deadlock_index(d, &pattern)) {
+		return false;
+	}
+	d->learned++;
+	return true;
+}
+
+struct deadlock_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t level_hash;
+	size_t stride;
+	size_t squares;
+	size_t patterns_size;
+};
+
+// Patterns only hold for the level they were learned on, which level_hash has to tell apart
+enum deadlock_file {
+	DEADLOCK_FILE_LOADED,
+	DEADLOCK_FILE_MISSING, // Saving is fine, since there's nothing to overwrite
+	DEADLOCK_FILE_OTHER, // Of another level or solver, or unreadable, which saving mustn't overwrite
+};
+
+static enum deadlock_file deadlock_load(struct deadlocks *d, const char *path, uint32_t level_hash) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return errno == ENOENT ? DEADLOCK_FILE_MISSING : DEADLOCK_FILE_OTHER;
+	}
+
+	struct deadlock_file_header header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1
+		&& memcmp(header.magic, DEADLOCK_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == DEADLOCK_VERSION
+		&& header.level_hash == level_hash
+		&& header.stride == d->stride
+		&& header.squares == d->squares;
+
+	for (size_t i = 0; ok && i < header.patterns_size; i++) {
+		struct deadlock_pattern pattern;
+		ok = fread(pattern.boxes, sizeof(uint64_t), d->words, f) == d->words
+			&& fread(pattern.area, sizeof(uint64_t), d->words, f) == d->words
+			&& deadlock_index(d, &pattern);
+	}
+
+	fclose(f);
+	return ok ? DEADLOCK_FILE_LOADED : DEADLOCK_FILE_OTHER;
+}
+
+static bool deadlock_save(const struct deadlocks *d, const char *path, uint32_t level_hash) {
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		return false;
+	}
+
+	struct deadlock_file_header header = {
+		.magic = DEADLOCK_MAGIC,
+		.version = DEADLOCK_VERSION,
+		.level_hash = level_hash,
+		.stride = d->stride,
+		.squares = d->squares,
+		.patterns_size = d->patterns_size,
+	};
+	size_t words = d->patterns_size * 2 * d->words;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(d->patterns, sizeof(uint64_t), words, f) == words;
+
+	return fclose(f) == 0 && ok;
+}
+
+#endif
@@ -0,0 +1,121 @@
+// How many pushes it takes to get a box from every tile onto every storage, if the other boxes weren't in the way
+//
+// Found by pulling a box away from each storage in every possible way, which is a BFS over the tiles,
+// where pulling the box one tile needs the tile beyond that to be free for the player.
+// The table has a row of the pushes to every storage for every tile, so the costs of a box that moves are next to each other,
+// and is as compact as the cropped map allows. A level with more storages than DISTANCES_MAX_STORAGES only gets nearest,
+// which a single BFS from all storages at once finds.
+// A tile that no storage can be reached from is dead: a box that's pushed onto it can never be put in storage.
+// The player isn't checked to be able to get around to where it has to pull from, so distances never overestimate
+//
+// Tiles are numbered x + y * width, with the width of the cropped map
+
+#ifndef DISTANCES_H
+#define DISTANCES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define DISTANCES_MAX_TILES 4096
+#define DISTANCES_MAX_STORAGES 64
+#define DISTANCES_UNREACHABLE UINT16_MAX
+
+struct distances {
+	size_t width;
+	size_t tiles;
+	size_t storages; // The number of columns of pushes, or 0 if there were too many storages
+	uint16_t pushes[DISTANCES_MAX_TILES * DISTANCES_MAX_STORAGES]; // pushes[tile * storages + storage]
+	uint16_t nearest[DISTANCES_MAX_TILES]; // The fewest pushes to any storage
+	size_t dead; // The floor tiles that are dead
+	double seconds; // How long the tables took to fill
+};
+
+// Pulls a box away from the storages that the queue starts out with, writing the pushes from every tile at distances[tile * stride]
+static void distances_pull(const bool *walls, size_t width, size_t height, uint16_t *queue, size_t queue_end, uint16_t *distances, size_t stride) {
+	const int offsets[4][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+	for (size_t queue_start = 0; queue_start < queue_end; queue_start++) {
+		size_t x = queue[queue_start] % width;
+		size_t y = queue[queue_start] / width;
+
+		// The box gets pulled one tile, and the player pulling it ends up one tile beyond that
+		for (size_t i = 0; i < 4; i++) {
+			size_t box_x = x + offsets[i][0];
+			size_t box_y = y + offsets[i][1];
+			size_t puller_x = box_x + offsets[i][0];
+			size_t puller_y = box_y + offsets[i][1];
+			if (puller_x >= width || puller_y >= height) { // Going below 0 wraps around
+				continue;
+			}
+			size_t box = box_x + box_y * width;
+			if (!walls[box] && !walls[puller_x + puller_y * width] && distances[box * stride] == DISTANCES_UNREACHABLE) {
+				distances[box * stride] = distances[queue[queue_start] * stride] + 1;
+				queue[queue_end++] = box;
+			}
+		}
+	}
+}
+
+// Fills the tables of a map of width * height tiles, where walls and storages say which tiles are what
+static void distances_init(struct distances *d, const bool *walls, const bool *storages, size_t width, size_t height) {
+	static uint16_t queue[DISTANCES_MAX_TILES];
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	d->width = width;
+	d->tiles = width * height;
+	size_t storages_size = 0;
+	for (size_t tile = 0; tile < d->tiles; tile++) {
+		storages_size += storages[tile];
+	}
+	d->storages = storages_size <= DISTANCES_MAX_STORAGES ? storages_size : 0;
+
+	// Every storage on its own, for the columns of pushes
+	for (size_t i = 0; i < d->tiles * d->storages; i++) {
+		d->pushes[i] = DISTANCES_UNREACHABLE;
+	}
+	size_t storage = 0;
+	for (size_t tile = 0; tile < d->tiles && d->storages > 0; tile++) {
+		if (storages[tile]) {
+			d->pushes[tile * d->storages + storage] = 0;
+			queue[0] = tile;
+			distances_pull(walls, width, height, queue, 1, d->pushes + storage, d->storages);
+			storage++;
+		}
+	}
+
+	// All storages at once, for nearest
+	size_t queue_end = 0;
+	for (size_t tile = 0; tile < d->tiles; tile++) {
+		d->nearest[tile] = storages[tile] ? 0 : DISTANCES_UNREACHABLE;
+		if (storages[tile]) {
+			queue[queue_end++] = tile;
+		}
+	}
+	distances_pull(walls, width, height, queue, queue_end, d->nearest, 1);
+
+	d->dead = 0;
+	for (size_t tile = 0; tile < d->tiles; tile++) {
+		d->dead += !walls[tile] && d->nearest[tile] == DISTANCES_UNREACHABLE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	d->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static inline uint16_t distances_get(const struct distances *d, size_t tile, size_t storage) {
+	return d->pushes[tile * d->storages + storage];
+}
+
+static inline bool distances_dead(const struct distances *d, size_t tile) {
+	return d->nearest[tile] == DISTANCES_UNREACHABLE;
+}
+
+static void distances_print(const struct distances *d) {
+	printf("distances: %zu tiles x %zu storages in %.3f ms, %zu dead tiles\n\n", d->tiles, d->storages, d->seconds * 1e3, d->dead);
+}
+
+#endif
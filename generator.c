@@ -0,0 +1,291 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_HEIGHT 256
+#define MAX_WIDTH 256
+#define MAX_ATTEMPTS 100
+
+enum tile {
+	WALL,
+	FLOOR,
+	STORAGE,
+};
+
+struct pull {
+	size_t box_x;
+	size_t box_y;
+	int dx;
+	int dy;
+};
+
+static enum tile map[MAX_HEIGHT][MAX_WIDTH];
+static bool boxes[MAX_HEIGHT][MAX_WIDTH];
+static bool reachable[MAX_HEIGHT][MAX_WIDTH];
+
+static size_t width = 10;
+static size_t height = 10;
+static size_t box_count = 3;
+static double density = 0.6; // The fraction of the tiles inside the outer walls that are floor
+static uint64_t seed = 1;
+static size_t pulls = 100;
+static size_t count = 1;
+
+static size_t player_x;
+static size_t player_y;
+
+static uint64_t rng;
+
+// xorshift64
+static uint64_t next_random(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+static size_t random_below(size_t n) {
+	return next_random() % n;
+}
+
+// Every level gets its own stream, so a level of a --count run can be regenerated on its own
+static void seed_level(size_t level) {
+	// splitmix64, since xorshift64 mustn't start at 0, and similar seeds should give unrelated streams
+	uint64_t z = seed + (level + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	rng = (z ^ (z >> 31)) | 1;
+}
+
+static bool is_open(size_t x, size_t y) {
+	return map[y][x] != WALL && !boxes[y][x];
+}
+
+// Grows a connected area of floor from the center, one random wall tile next to it at a time,
+// so that a low density leaves narrow corridors, and a high density leaves rooms
+static void carve(void) {
+	static size_t frontier[MAX_HEIGHT * MAX_WIDTH];
+	static bool in_frontier[MAX_HEIGHT][MAX_WIDTH];
+	size_t frontier_size = 0;
+
+	memset(map, WALL, sizeof(map));
+	memset(in_frontier, false, sizeof(in_frontier));
+
+	size_t interior = (width - 2) * (height - 2);
+	size_t target = interior * density + 0.5;
+	if (target < box_count + 1) {
+		target = box_count + 1;
+	}
+
+	frontier[frontier_size++] = width / 2 + height / 2 * MAX_WIDTH;
+	in_frontier[height / 2][width / 2] = true;
+
+	for (size_t floors = 0; floors < target && frontier_size > 0; floors++) {
+		size_t i = random_below(frontier_size);
+		size_t x = frontier[i] % MAX_WIDTH;
+		size_t y = frontier[i] / MAX_WIDTH;
+		frontier[i] = frontier[--frontier_size];
+
+		map[y][x] = FLOOR;
+
+		static const int dxs[] = {0, 1, 0, -1};
+		static const int dys[] = {-1, 0, 1, 0};
+		for (size_t d = 0; d < 4; d++) {
+			size_t nx = x + dxs[d];
+			size_t ny = y + dys[d];
+			if (nx == 0 || ny == 0 || nx == width - 1 || ny == height - 1 || in_frontier[ny][nx]) {
+				continue;
+			}
+			in_frontier[ny][nx] = true;
+			frontier[frontier_size++] = nx + ny * MAX_WIDTH;
+		}
+	}
+}
+
+// Picks a random floor tile that doesn't have a box, where storage counts as floor if allowed
+static void random_free_tile(bool allow_storage, size_t *x, size_t *y) {
+	do {
+		*x = 1 + random_below(width - 2);
+		*y = 1 + random_below(height - 2);
+	} while (map[*y][*x] == WALL || boxes[*y][*x] || (!allow_storage && map[*y][*x] == STORAGE));
+}
+
+static void flood(void) {
+	static size_t stack[MAX_HEIGHT * MAX_WIDTH];
+	size_t stack_size = 0;
+
+	memset(reachable, false, sizeof(reachable));
+	reachable[player_y][player_x] = true;
+	stack[stack_size++] = player_x + player_y * MAX_WIDTH;
+
+	while (stack_size > 0) {
+		size_t x = stack[--stack_size] % MAX_WIDTH;
+		size_t y = stack[stack_size] / MAX_WIDTH;
+
+		static const int dxs[] = {0, 1, 0, -1};
+		static const int dys[] = {-1, 0, 1, 0};
+		for (size_t d = 0; d < 4; d++) {
+			size_t nx = x + dxs[d];
+			size_t ny = y + dys[d];
+			if (is_open(nx, ny) && !reachable[ny][nx]) {
+				reachable[ny][nx] = true;
+				stack[stack_size++] = nx + ny * MAX_WIDTH;
+			}
+		}
+	}
+}
+
+// A pull is the reverse of a push, so every level that is reached by pulling boxes off their storages
+// can be solved by pushing them back in the reverse order
+static bool pull_random_box(void) {
+	static struct pull candidates[MAX_HEIGHT * MAX_WIDTH * 4];
+	size_t candidate_count = 0;
+
+	flood();
+
+	for (size_t y = 1; y < height - 1; y++) {
+		for (size_t x = 1; x < width - 1; x++) {
+			if (!boxes[y][x]) {
+				continue;
+			}
+
+			static const int dxs[] = {0, 1, 0, -1};
+			static const int dys[] = {-1, 0, 1, 0};
+			for (size_t d = 0; d < 4; d++) {
+				// The player stands next to the box, and steps back away from it
+				size_t px = x + dxs[d];
+				size_t py = y + dys[d];
+				size_t bx = px + dxs[d];
+				size_t by = py + dys[d];
+				if (reachable[py][px] && is_open(bx, by)) {
+					candidates[candidate_count++] = (struct pull){.box_x=x, .box_y=y, .dx=dxs[d], .dy=dys[d]};
+				}
+			}
+		}
+	}
+
+	if (candidate_count == 0) {
+		return false;
+	}
+
+	struct pull p = candidates[random_below(candidate_count)];
+	boxes[p.box_y][p.box_x] = false;
+	boxes[p.box_y + p.dy][p.box_x + p.dx] = true;
+	player_x = p.box_x + 2 * p.dx;
+	player_y = p.box_y + 2 * p.dy;
+	return true;
+}
+
+static bool is_solved(void) {
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (boxes[y][x] && map[y][x] != STORAGE) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool generate(void) {
+	carve();
+	memset(boxes, false, sizeof(boxes));
+
+	for (size_t i = 0; i < box_count; i++) {
+		size_t x;
+		size_t y;
+		random_free_tile(false, &x, &y);
+		map[y][x] = STORAGE;
+		boxes[y][x] = true;
+	}
+
+	random_free_tile(true, &player_x, &player_y);
+
+	for (size_t i = 0; i < pulls && pull_random_box(); i++) {}
+
+	// The player can end up anywhere it could've walked to
+	flood();
+	do {
+		random_free_tile(true, &player_x, &player_y);
+	} while (!reachable[player_y][player_x]);
+
+	return !is_solved();
+}
+
+static void print_level(size_t level) {
+	printf("%% Generated with --width %zu --height %zu --boxes %zu --density %g --seed %llu --pulls %zu, level %zu\n",
+		width, height, box_count, density, (unsigned long long)seed, pulls, level + 1);
+
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			bool player = x == player_x && y == player_y;
+			bool storage = map[y][x] == STORAGE;
+			char c = ' ';
+			if (map[y][x] == WALL) {
+				c = '#';
+			} else if (boxes[y][x]) {
+				c = storage ? '*' : '$';
+			} else if (player) {
+				c = storage ? '+' : '@';
+			} else if (storage) {
+				c = '.';
+			}
+			putchar(c);
+		}
+		putchar('\n');
+	}
+}
+
+static void usage(const char *program) {
+	fprintf(stderr, "Usage: %s [--width n] [--height n] [--boxes n] [--density fraction] [--seed n] [--pulls n] [--count n] > map.txt\n", program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+			width = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) {
+			height = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--boxes") == 0 && i + 1 < argc) {
+			box_count = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--density") == 0 && i + 1 < argc) {
+			density = strtod(argv[++i], NULL);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--pulls") == 0 && i + 1 < argc) {
+			pulls = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+			count = strtoull(argv[++i], NULL, 10);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (width < 3 || height < 3 || width > MAX_WIDTH || height > MAX_HEIGHT) {
+		fprintf(stderr, "The width and height have to be between 3 and %d\n", MAX_WIDTH);
+		exit(EXIT_FAILURE);
+	}
+	if (box_count == 0 || box_count + 1 > (width - 2) * (height - 2) || density <= 0 || density > 1) {
+		fprintf(stderr, "There has to be at least one box, room for the boxes and the player, and a density in (0, 1]\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t level = 0; level < count; level++) {
+		seed_level(level);
+
+		size_t attempt = 0;
+		while (!generate()) {
+			if (++attempt == MAX_ATTEMPTS) {
+				fprintf(stderr, "Level %zu was still solved after %d attempts, so try more --pulls or a higher --density\n", level + 1, MAX_ATTEMPTS);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		// Every level ends with a blank line, so that files of them can be concatenated into a collection
+		print_level(level);
+		putchar('\n');
+	}
+}
@@ -1,30 +1,101 @@
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define MAX_HEIGHT 16
-#define MAX_WIDTH 16
+#include "anytime.h"
+#include "bench.h"
+#include "cache.h"
+#include "perf.h"
+#include "preprocess.h"
+#include "deadlock.h"
+#include "distances.h"
+#include "key.h"
+#include "levels.h"
+#include "matching.h"
+#include "pages.h"
+
+#define MAX_HEIGHT PREPROCESS_MAX_HEIGHT
+#define MAX_WIDTH PREPROCESS_MAX_WIDTH
 
 #define MAX_PATH_LENGTH 420420
 #define MAX_MAPS 42420420
 #define MAX_MAP_STRING_LENGTH 420420
 #define MAX_MAP_STRINGS_CHARS 420420420
 
+#define CHECKPOINT_MAGIC "SOKOIDDF"
+#define CHECKPOINT_VERSION 2
+#define PAGE_SIZE 4096
+#define PAGE_ALIGN(n) (((n) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1))
+
+#define DEADLOCKED INT32_MAX // The budget of a map that can't be solved, no matter how deep the search goes
+
+_Static_assert(MAX_WIDTH * MAX_HEIGHT <= DEADLOCK_SQUARES, "deadlock.h needs a bit for every tile");
+
+typedef uint8_t u8;
+typedef uint16_t u16;
 typedef uint32_t u32;
+typedef int32_t i32;
 typedef int64_t i64;
+typedef uint64_t u64;
+
+// The first page of a checkpoint file, followed by the memo tables exactly as they are laid out in memory
+struct checkpoint_header {
+	char magic[8];
+	u32 version;
+	u32 level_hash;
+	size_t max_maps;
+	size_t max_map_strings_chars;
+	size_t max_depth;
+	size_t current_solve_calls;
+	size_t total_solve_calls;
+	size_t maps_size;
+	size_t map_strings_size;
+};
+
+// A memo entry whose subtree is still being searched, along with the budget it had before this visit
+struct in_progress {
+	u32 index;
+	i32 previous_budget;
+};
 
-enum tile {
-	FLOOR,
-	WALL,
-	BOX,
-	STORAGE,
-	STORED_BOX,
+// A map that was recorded for the benchmarks
+struct bench_state {
+	enum tile map[MAX_HEIGHT][MAX_WIDTH];
+	size_t player_x;
+	size_t player_y;
+	i64 empty_storages;
+};
+
+enum move {
+	WALKED,
+	PUSHED_BOX,
+	PUSHED_STORED_BOX,
+};
+
+// A map on the search stack, along with everything that is needed to undo the move it's currently trying
+struct frame {
+	u32 index;
+	u64 discovery;
+	u64 outer_cycle;
+	size_t cutoffs_before;
+	size_t pending_before;
+
+	u8 direction; // The next direction to try
+	bool moved;
+	enum move move;
+	bool deadlocked;
+	struct matching_undo undo;
 };
 
 static enum tile map[MAX_HEIGHT][MAX_WIDTH];
@@ -35,6 +106,13 @@ static size_t height = 0;
 static size_t player_x;
 static size_t player_y;
 
+// Where the cropped map starts in the original one
+static size_t origin_x;
+static size_t origin_y;
+
+// Boxes on storage that got turned into walls, which are still printed as boxes
+static bool frozen[MAX_HEIGHT][MAX_WIDTH];
+
 static i64 empty_storages = 0;
 
 static size_t current_solve_calls;
@@ -45,18 +123,91 @@ static size_t max_depth = 1;
 static char path[MAX_PATH_LENGTH];
 static size_t path_length;
 
-static char *maps[MAX_MAPS];
-static size_t map_depths[MAX_MAPS];
+// The path to the map with the fewest empty storages so far, which is what a search that hits a limit reports
+static i64 best_empty_storages;
+static char best_path[MAX_PATH_LENGTH];
+static size_t best_path_length;
+
+static struct anytime anytime;
+
+static struct perf perf; // Only enabled with --perf
+
+// With --bench, the search only records maps, which the kernels are then benchmarked on
+static bool benchmarking;
+static struct bench bench;
+static struct bench_state bench_states[BENCH_MAX_SAMPLES];
+
+static struct cache cache = {.variant="iddfs"};
+static bool from_cache; // Whether the result came out of the cache, so it doesn't need to be stored again
+
+// Index 0 is never used, so that a 0 in buckets or chains can mean "end of chain"
+// This lets a fresh or resumed table start out as all zero pages
+static u32 *map_offsets;
+static i32 *map_budgets; // How many more moves the map was searched for; -1 if it never finished
 static size_t maps_size;
 
 static char map_string[MAX_MAP_STRING_LENGTH];
 static size_t map_string_length;
 
-static char map_strings[MAX_MAP_STRINGS_CHARS];
+// The memo table is keyed by which floor tiles have a box and where the player is, see key.h
+static struct key_format key_format;
+static u16 floor_indices[MAX_HEIGHT][MAX_WIDTH];
+static u8 floor_x[MAX_HEIGHT * MAX_WIDTH];
+static u8 floor_y[MAX_HEIGHT * MAX_WIDTH];
+static size_t floors_size;
+
+static char *map_strings;
 static size_t map_strings_size;
 
-static u32 buckets[MAX_MAPS];
-static u32 chains[MAX_MAPS];
+static u32 *buckets;
+static u32 *chains;
+
+static char *tables;
+static size_t tables_size;
+static struct pages pages; // Where the memo tables got their pages from, see pages.h
+
+static struct in_progress in_progress[MAX_PATH_LENGTH];
+
+// solve() used to recurse once per move, so the search keeps its own stack instead
+static struct frame frames[MAX_PATH_LENGTH + 1];
+
+static u32 level_hash;
+
+static const char *checkpoint_path = "iddfs.checkpoint";
+static unsigned checkpoint_interval;
+static volatile sig_atomic_t checkpoint_requested;
+static volatile sig_atomic_t exit_requested;
+
+// Matches boxes with storages, for a lower bound on the number of pushes that are still needed
+static struct matching matching;
+static bool use_matching;
+static u8 box_ids[MAX_HEIGHT][MAX_WIDTH]; // The matching's column of the box on each tile, or 0
+
+// The pushes it takes to get a box from each tile onto each storage
+static struct distances distances;
+static bool dead_tiles[MAX_HEIGHT][MAX_WIDTH]; // Tiles that a box mustn't be pushed onto
+static bool use_nearest; // Whether the boxes' fewest pushes to any storage are the lower bound, for when there's no matching
+static size_t nearest_total;
+
+// Learns which groups of boxes are deadlocked
+static struct deadlocks deadlocks;
+static bool use_deadlocks;
+static const char *deadlocks_path;
+static u64 box_tiles[DEADLOCK_WORDS];
+
+// How often the search got cut short by how deep it was allowed to go
+// A subtree that finishes without increasing this is deadlocked,
+// as long as it didn't go in a circle back to a map above it
+static size_t cutoffs;
+
+// Maps are numbered in the order they are searched, like in Tarjan's strongly connected components algorithm
+// A map that went in a circle waits on the pending stack until the map it went back to is finished,
+// since they're either all deadlocked, or none of them are
+static u64 discoveries;
+static u64 shallowest_cycle = UINT64_MAX; // The earliest discovered map that the current subtree went in a circle back to
+static u32 pending[MAX_MAPS];
+static size_t pending_size;
+static u64 *pending_discoveries; // 0 if the map isn't pending; probed by map index like the memo table, so it's on huge pages too
 
 static char tile_to_char(enum tile t) {
 	switch (t) {
@@ -94,51 +245,123 @@ static void print_iddfs_stats(void) {
 	printf("current_solve_calls: %zu\n", current_solve_calls);
 	printf("total_solve_calls: %zu\n", total_solve_calls);
 	printf("branching factor: %.2f\n", pow(current_solve_calls, 1.0/max_depth)); // O(branching_factor ^ depth)
-	printf("'wasted' solve() calls on iterative deepening: %.2f%%\n\n", (double)(total_solve_calls - current_solve_calls) / total_solve_calls * 100);
+	if (use_deadlocks) {
+		printf("deadlock patterns: %zu learned, %zu matched\n", deadlocks.learned, deadlocks.matched);
+	}
+	pages_print(&pages);
+	if (total_solve_calls > 0) { // A cache hit doesn't search at all
+		printf("'wasted' solve() calls on iterative deepening: %.2f%%\n", (double)(total_solve_calls - current_solve_calls) / total_solve_calls * 100);
+	}
+	printf("\n");
 }
 
 static void print_map(void) {
 	print_iddfs_stats();
 	printf("width: %zu\n", width);
 	printf("height: %zu\n", height);
-	printf("player_x: %zu\n", player_x);
-	printf("player_y: %zu\n", player_y);
+	printf("player_x: %zu\n", player_x + origin_x);
+	printf("player_y: %zu\n", player_y + origin_y);
 	printf("empty_storages: %zu\n", empty_storages);
 	printf("path_length: %zu\n", path_length);
 	printf("path: '%.*s'\n", (int)path_length, path);
 	printf("depth: %zu\n", max_depth);
 	for (size_t y = 0; y < height; y++) {
 		for (size_t x = 0; x < width; x++) {
-			printf("%c", x == player_x && y == player_y ? '@' : tile_to_char(map[y][x]));
+			printf("%c", x == player_x && y == player_y ? '@' : frozen[y][x] ? tile_to_char(STORED_BOX) : tile_to_char(map[y][x]));
 		}
 		printf("\n");
 	}
 	printf("\n");
 }
 
+static void print_result(const char *status) {
+	bool solved = strcmp(status, "solved") == 0;
+	if (!from_cache && (solved || strcmp(status, "unsolved") == 0)) {
+		path[path_length] = '\0';
+		cache_store(&cache, &anytime, status, solved ? path_length : 0, solved ? path : "");
+	}
+
+	anytime_print(&anytime, status);
+
+	// A solution is already printed as the path
+	if (solved) {
+		return;
+	}
+	printf("best empty_storages: %zu\n", best_empty_storages);
+	printf("best path_length: %zu\n", best_path_length);
+	printf("best path: '%.*s'\n", (int)best_path_length, best_path);
+}
+
 static void check_is_solved(void) {
-	if (empty_storages == 0) {
+	// A real search would've stopped here, so the recording does too
+	if (empty_storages == 0 && benchmarking) {
+		bench.solved = true;
+	}
+	if (empty_storages == 0 && !benchmarking) {
+		perf_begin(&perf, anytime.nodes);
 		printf("Solved!\n");
 		print_map();
+		print_result("solved");
+		perf_end(&perf, "output", anytime.nodes);
 		exit(EXIT_SUCCESS);
 	}
 }
 
-static void solve(size_t depth);
+// The matching's cost of a box on the tile, for the storage
+static int push_cost(size_t tile, size_t storage) {
+	u16 pushes = distances_get(&distances, tile, storage);
+	return pushes == DISTANCES_UNREACHABLE ? MATCHING_UNREACHABLE : pushes;
+}
+
+// Keeps the matching and the box tiles up to date with a box that got pushed from one tile to another
+// Returns whether the boxes now contain a learned deadlock pattern
+static bool move_box(size_t from_x, size_t from_y, size_t to_x, size_t to_y, struct matching_undo *undo) {
+	deadlock_remove(box_tiles, from_x + from_y * width);
+	deadlock_add(box_tiles, to_x + to_y * width);
+
+	if (use_matching) {
+		u8 id = box_ids[from_y][from_x];
+		box_ids[from_y][from_x] = 0;
+		box_ids[to_y][to_x] = id;
+
+		int costs[MATCHING_MAX];
+		for (size_t i = 0; i < matching.rows; i++) {
+			costs[i] = push_cost(to_x + to_y * width, i);
+		}
+		matching_move_box(&matching, id, costs, undo);
+	} else if (use_nearest) {
+		nearest_total += distances.nearest[to_x + to_y * width] - distances.nearest[from_x + from_y * width];
+	}
 
-static void up(size_t depth) {
+	// The player always ends up where the box was
+	return use_deadlocks && deadlock_matches(&deadlocks, box_tiles, to_x + to_y * width, from_x + from_y * width);
+}
+
+static void undo_move_box(size_t from_x, size_t from_y, size_t to_x, size_t to_y, const struct matching_undo *undo) {
+	deadlock_remove(box_tiles, to_x + to_y * width);
+	deadlock_add(box_tiles, from_x + from_y * width);
+
+	if (use_matching) {
+		box_ids[from_y][from_x] = box_ids[to_y][to_x];
+		box_ids[to_y][to_x] = 0;
+		matching_undo_move(&matching, undo);
+	} else if (use_nearest) {
+		nearest_total += distances.nearest[from_x + from_y * width] - distances.nearest[to_x + to_y * width];
+	}
+}
+
+static bool up(struct frame *f) {
 	if (map[player_y-1][player_x] == FLOOR || map[player_y-1][player_x] == STORAGE) {
 		path[path_length++] = 'u';
 		player_y--;
 
-		solve(depth+1);
-
-		path_length--;
-		player_y++;
+		f->move = WALKED;
+		f->deadlocked = false;
+		return true;
 	} else if (map[player_y-1][player_x] == BOX && (map[player_y-2][player_x] == FLOOR || map[player_y-2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y-2][player_x] == FLOOR && map[player_y-3][player_x] == WALL && (map[player_y-2][player_x-1] == WALL || map[player_y-2][player_x+1] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y-2][player_x]) {
+			return false;
 		}
 
 		path[path_length++] = 'U';
@@ -150,19 +373,13 @@ static void up(size_t depth) {
 			check_is_solved();
 		}
 
-		solve(depth+1);
-
-		path_length--;
-		player_y++;
-		if (map[player_y-2][player_x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y-2][player_x] = map[player_y-2][player_x] == BOX ? FLOOR : STORAGE;
-		map[player_y-1][player_x] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x, player_y-1, &f->undo);
+		return true;
 	} else if (map[player_y-1][player_x] == STORED_BOX && (map[player_y-2][player_x] == FLOOR || map[player_y-2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y-2][player_x] == FLOOR && map[player_y-3][player_x] == WALL && (map[player_y-2][player_x-1] == WALL || map[player_y-2][player_x+1] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y-2][player_x]) {
+			return false;
 		}
 
 		path[path_length++] = 'U';
@@ -174,32 +391,46 @@ static void up(size_t depth) {
 			empty_storages--;
 		}
 
-		solve(depth+1);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x, player_y-1, &f->undo);
+		return true;
+	}
+	return false;
+}
 
+static void undo_up(const struct frame *f) {
+	if (f->move == WALKED) {
 		path_length--;
 		player_y++;
+		return;
+	}
+
+	undo_move_box(player_x, player_y, player_x, player_y-1, &f->undo);
+
+	path_length--;
+	player_y++;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[player_y-2][player_x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y-2][player_x] = map[player_y-2][player_x] == BOX ? FLOOR : STORAGE;
-		map[player_y-1][player_x] = STORED_BOX;
 	}
+	if (map[player_y-2][player_x] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[player_y-2][player_x] = map[player_y-2][player_x] == BOX ? FLOOR : STORAGE;
+	map[player_y-1][player_x] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void down(size_t depth) {
+static bool down(struct frame *f) {
 	if (map[player_y+1][player_x] == FLOOR || map[player_y+1][player_x] == STORAGE) {
 		path[path_length++] = 'd';
 		player_y++;
 
-		solve(depth+1);
-
-		path_length--;
-		player_y--;
+		f->move = WALKED;
+		f->deadlocked = false;
+		return true;
 	} else if (map[player_y+1][player_x] == BOX && (map[player_y+2][player_x] == FLOOR || map[player_y+2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y+2][player_x] == FLOOR && map[player_y+3][player_x] == WALL && (map[player_y+2][player_x-1] == WALL || map[player_y+2][player_x+1] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y+2][player_x]) {
+			return false;
 		}
 
 		path[path_length++] = 'D';
@@ -211,19 +442,13 @@ static void down(size_t depth) {
 			check_is_solved();
 		}
 
-		solve(depth+1);
-
-		path_length--;
-		player_y--;
-		if (map[player_y+2][player_x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y+2][player_x] = map[player_y+2][player_x] == BOX ? FLOOR : STORAGE;
-		map[player_y+1][player_x] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x, player_y+1, &f->undo);
+		return true;
 	} else if (map[player_y+1][player_x] == STORED_BOX && (map[player_y+2][player_x] == FLOOR || map[player_y+2][player_x] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y+2][player_x] == FLOOR && map[player_y+3][player_x] == WALL && (map[player_y+2][player_x-1] == WALL || map[player_y+2][player_x+1] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y+2][player_x]) {
+			return false;
 		}
 
 		path[path_length++] = 'D';
@@ -235,32 +460,46 @@ static void down(size_t depth) {
 			empty_storages--;
 		}
 
-		solve(depth+1);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x, player_y+1, &f->undo);
+		return true;
+	}
+	return false;
+}
 
+static void undo_down(const struct frame *f) {
+	if (f->move == WALKED) {
 		path_length--;
 		player_y--;
+		return;
+	}
+
+	undo_move_box(player_x, player_y, player_x, player_y+1, &f->undo);
+
+	path_length--;
+	player_y--;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[player_y+2][player_x] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y+2][player_x] = map[player_y+2][player_x] == BOX ? FLOOR : STORAGE;
-		map[player_y+1][player_x] = STORED_BOX;
 	}
+	if (map[player_y+2][player_x] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[player_y+2][player_x] = map[player_y+2][player_x] == BOX ? FLOOR : STORAGE;
+	map[player_y+1][player_x] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void left(size_t depth) {
+static bool left(struct frame *f) {
 	if (map[player_y][player_x-1] == FLOOR || map[player_y][player_x-1] == STORAGE) {
 		path[path_length++] = 'l';
 		player_x--;
 
-		solve(depth+1);
-
-		path_length--;
-		player_x++;
+		f->move = WALKED;
+		f->deadlocked = false;
+		return true;
 	} else if (map[player_y][player_x-1] == BOX && (map[player_y][player_x-2] == FLOOR || map[player_y][player_x-2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x-2] == FLOOR && map[player_y][player_x-3] == WALL && (map[player_y-1][player_x-2] == WALL || map[player_y+1][player_x-2] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x-2]) {
+			return false;
 		}
 
 		path[path_length++] = 'L';
@@ -272,19 +511,13 @@ static void left(size_t depth) {
 			check_is_solved();
 		}
 
-		solve(depth+1);
-
-		path_length--;
-		player_x++;
-		if (map[player_y][player_x-2] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y][player_x-2] = map[player_y][player_x-2] == BOX ? FLOOR : STORAGE;
-		map[player_y][player_x-1] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x-1, player_y, &f->undo);
+		return true;
 	} else if (map[player_y][player_x-1] == STORED_BOX && (map[player_y][player_x-2] == FLOOR || map[player_y][player_x-2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x-2] == FLOOR && map[player_y][player_x-3] == WALL && (map[player_y-1][player_x-2] == WALL || map[player_y+1][player_x-2] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x-2]) {
+			return false;
 		}
 
 		path[path_length++] = 'L';
@@ -296,32 +529,46 @@ static void left(size_t depth) {
 			empty_storages--;
 		}
 
-		solve(depth+1);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x-1, player_y, &f->undo);
+		return true;
+	}
+	return false;
+}
 
+static void undo_left(const struct frame *f) {
+	if (f->move == WALKED) {
 		path_length--;
 		player_x++;
+		return;
+	}
+
+	undo_move_box(player_x, player_y, player_x-1, player_y, &f->undo);
+
+	path_length--;
+	player_x++;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[player_y][player_x-2] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y][player_x-2] = map[player_y][player_x-2] == BOX ? FLOOR : STORAGE;
-		map[player_y][player_x-1] = STORED_BOX;
 	}
+	if (map[player_y][player_x-2] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[player_y][player_x-2] = map[player_y][player_x-2] == BOX ? FLOOR : STORAGE;
+	map[player_y][player_x-1] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
-static void right(size_t depth) {
+static bool right(struct frame *f) {
 	if (map[player_y][player_x+1] == FLOOR || map[player_y][player_x+1] == STORAGE) {
 		path[path_length++] = 'r';
 		player_x++;
 
-		solve(depth+1);
-
-		path_length--;
-		player_x--;
+		f->move = WALKED;
+		f->deadlocked = false;
+		return true;
 	} else if (map[player_y][player_x+1] == BOX && (map[player_y][player_x+2] == FLOOR || map[player_y][player_x+2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x+2] == FLOOR && map[player_y][player_x+3] == WALL && (map[player_y-1][player_x+2] == WALL || map[player_y+1][player_x+2] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x+2]) {
+			return false;
 		}
 
 		path[path_length++] = 'R';
@@ -333,19 +580,13 @@ static void right(size_t depth) {
 			check_is_solved();
 		}
 
-		solve(depth+1);
-
-		path_length--;
-		player_x--;
-		if (map[player_y][player_x+2] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y][player_x+2] = map[player_y][player_x+2] == BOX ? FLOOR : STORAGE;
-		map[player_y][player_x+1] = BOX;
+		f->move = PUSHED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x+1, player_y, &f->undo);
+		return true;
 	} else if (map[player_y][player_x+1] == STORED_BOX && (map[player_y][player_x+2] == FLOOR || map[player_y][player_x+2] == STORAGE)) {
-		// If the box would get stuck in a wall corner, without being put in storage, the move is invalid
-		if (map[player_y][player_x+2] == FLOOR && map[player_y][player_x+3] == WALL && (map[player_y-1][player_x+2] == WALL || map[player_y+1][player_x+2] == WALL)) {
-			return;
+		// A box that's pushed onto a dead tile can't ever be put in storage
+		if (dead_tiles[player_y][player_x+2]) {
+			return false;
 		}
 
 		path[path_length++] = 'R';
@@ -357,17 +598,32 @@ static void right(size_t depth) {
 			empty_storages--;
 		}
 
-		solve(depth+1);
+		f->move = PUSHED_STORED_BOX;
+		f->deadlocked = move_box(player_x, player_y, player_x+1, player_y, &f->undo);
+		return true;
+	}
+	return false;
+}
 
+static void undo_right(const struct frame *f) {
+	if (f->move == WALKED) {
 		path_length--;
 		player_x--;
+		return;
+	}
+
+	undo_move_box(player_x, player_y, player_x+1, player_y, &f->undo);
+
+	path_length--;
+	player_x--;
+	if (f->move == PUSHED_STORED_BOX) {
 		empty_storages--;
-		if (map[player_y][player_x+2] == STORED_BOX) {
-			empty_storages++;
-		}
-		map[player_y][player_x+2] = map[player_y][player_x+2] == BOX ? FLOOR : STORAGE;
-		map[player_y][player_x+1] = STORED_BOX;
 	}
+	if (map[player_y][player_x+2] == STORED_BOX) {
+		empty_storages++;
+	}
+	map[player_y][player_x+2] = map[player_y][player_x+2] == BOX ? FLOOR : STORAGE;
+	map[player_y][player_x+1] = f->move == PUSHED_BOX ? BOX : STORED_BOX;
 }
 
 static void stringify_map(void) {
@@ -381,6 +637,19 @@ static void stringify_map(void) {
 	map_string[map_string_length] = '\0';
 }
 
+// Writes the map's key into map_string, which only looks at the floor tiles, unlike stringify_map()
+static void key_map(void) {
+	static u16 box_floors[MAX_HEIGHT * MAX_WIDTH];
+	size_t boxes = 0;
+	for (size_t i = 0; i < floors_size; i++) {
+		enum tile t = map[floor_y[i]][floor_x[i]];
+		box_floors[boxes] = i;
+		boxes += t == BOX || t == STORED_BOX; // Branchless, since whether a floor tile has a box is a coin flip
+	}
+	key_encode(&key_format, map_string, box_floors, boxes, floor_indices[player_y][player_x]);
+	map_string_length = key_format.length;
+}
+
 // From https://sourceware.org/git/?p=binutils-gdb.git;a=blob;f=bfd/elf.c#l193
 static u32 elf_hash(const char *namearg) {
 	u32 h = 0;
@@ -391,105 +660,772 @@ static u32 elf_hash(const char *namearg) {
 	return h & 0x0fffffff;
 }
 
-static void solve(size_t depth) {
+static void use_tables(char *t) {
+	tables = t;
+	buckets = (u32 *)tables;
+	chains = (u32 *)(tables + PAGE_ALIGN(MAX_MAPS * sizeof(u32)));
+	map_budgets = (i32 *)((char *)chains + PAGE_ALIGN(MAX_MAPS * sizeof(u32)));
+	map_offsets = (u32 *)((char *)map_budgets + PAGE_ALIGN(MAX_MAPS * sizeof(i32)));
+	map_strings = (char *)map_offsets + PAGE_ALIGN(MAX_MAPS * sizeof(u32));
+}
+
+static void allocate_tables(void) {
+	tables_size = PAGE_ALIGN(MAX_MAPS * sizeof(u32)) * 2 + PAGE_ALIGN(MAX_MAPS * sizeof(i32)) + PAGE_ALIGN(MAX_MAPS * sizeof(u32)) + PAGE_ALIGN(MAX_MAP_STRINGS_CHARS);
+
+	use_tables(pages_map(&pages, tables_size));
+
+	maps_size = 1;
+	map_strings_size = 0;
+}
+
+static bool write_all(int fd, const void *buf, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t written = pwrite(fd, buf, size, offset);
+		if (written < 0) {
+			return false;
+		}
+		buf = (const char *)buf + written;
+		size -= written;
+		offset += written;
+	}
+	return true;
+}
+
+// Pages of buckets that are still all zero are left as holes, so the file stays sparse
+static bool write_sparse(int fd, const char *buf, size_t size, off_t offset) {
+	static const char zero_page[PAGE_SIZE];
+	for (size_t i = 0; i < size; i += PAGE_SIZE) {
+		size_t n = size - i < PAGE_SIZE ? size - i : PAGE_SIZE;
+		if (memcmp(buf + i, zero_page, n) != 0 && !write_all(fd, buf + i, n, offset + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The maps on the current path haven't been fully searched yet,
+// so their budgets are rolled back while the tables are written
+static void swap_in_progress_budgets(size_t depth) {
+	for (size_t d = 1; d < depth; d++) {
+		i32 budget = map_budgets[in_progress[d].index];
+		map_budgets[in_progress[d].index] = in_progress[d].previous_budget;
+		in_progress[d].previous_budget = budget;
+	}
+}
+
+static void write_checkpoint(size_t depth) {
+	checkpoint_requested = 0;
+
+	struct checkpoint_header header = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.level_hash = level_hash,
+		.max_maps = MAX_MAPS,
+		.max_map_strings_chars = MAX_MAP_STRINGS_CHARS,
+		.max_depth = max_depth,
+		.current_solve_calls = current_solve_calls,
+		.total_solve_calls = total_solve_calls,
+		.maps_size = maps_size,
+		.map_strings_size = map_strings_size,
+	};
+
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", checkpoint_path);
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(tmp_path);
+		return;
+	}
+
+	swap_in_progress_budgets(depth);
+
+	bool ok = write_all(fd, &header, sizeof(header), 0)
+		&& write_sparse(fd, (char *)buckets, MAX_MAPS * sizeof(u32), PAGE_SIZE)
+		&& write_all(fd, chains, maps_size * sizeof(u32), PAGE_SIZE + ((char *)chains - tables))
+		&& write_all(fd, map_budgets, maps_size * sizeof(i32), PAGE_SIZE + ((char *)map_budgets - tables))
+		&& write_all(fd, map_offsets, maps_size * sizeof(u32), PAGE_SIZE + ((char *)map_offsets - tables))
+		&& write_all(fd, map_strings, map_strings_size, PAGE_SIZE + (map_strings - tables))
+		&& ftruncate(fd, PAGE_SIZE + tables_size) == 0
+		&& fsync(fd) == 0;
+
+	swap_in_progress_budgets(depth);
+
+	if (close(fd) != 0 || !ok || rename(tmp_path, checkpoint_path) != 0) {
+		perror(checkpoint_path);
+		unlink(tmp_path);
+		return;
+	}
+
+	fprintf(stderr, "Wrote checkpoint '%s' at max_depth %zu with %zu memoized maps\n", checkpoint_path, max_depth, maps_size - 1);
+
+	if (exit_requested) {
+		exit(EXIT_FAILURE);
+	}
+	alarm(checkpoint_interval);
+}
+
+// The tables are mapped straight from the file, so resuming only pages in the parts that get probed
+static void load_checkpoint(void) {
+	int fd = open(checkpoint_path, O_RDONLY);
+	if (fd < 0) {
+		perror(checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+
+	struct checkpoint_header header;
+	struct stat st;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) != 0) {
+		fprintf(stderr, "Couldn't read checkpoint '%s'\n", checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+
+	tables_size = PAGE_ALIGN(MAX_MAPS * sizeof(u32)) * 2 + PAGE_ALIGN(MAX_MAPS * sizeof(i32)) + PAGE_ALIGN(MAX_MAPS * sizeof(u32)) + PAGE_ALIGN(MAX_MAP_STRINGS_CHARS);
+
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+	 || header.version != CHECKPOINT_VERSION
+	 || header.max_maps != MAX_MAPS
+	 || header.max_map_strings_chars != MAX_MAP_STRINGS_CHARS
+	 || (size_t)st.st_size != PAGE_SIZE + tables_size) {
+		fprintf(stderr, "'%s' isn't a checkpoint of this version of iddfs.c\n", checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+	if (header.level_hash != level_hash) {
+		fprintf(stderr, "'%s' is a checkpoint of a different map\n", checkpoint_path);
+		exit(EXIT_FAILURE);
+	}
+
+	char *t = mmap(NULL, tables_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, PAGE_SIZE);
+	if (t == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	use_tables(t);
+
+	max_depth = header.max_depth;
+	current_solve_calls = header.current_solve_calls;
+	total_solve_calls = header.total_solve_calls;
+	maps_size = header.maps_size;
+	map_strings_size = header.map_strings_size;
+
+	fprintf(stderr, "Resuming '%s' at max_depth %zu with %zu memoized maps\n", checkpoint_path, max_depth, maps_size - 1);
+}
+
+static void handle_signal(int sig) {
+	checkpoint_requested = 1;
+	if (sig == SIGINT || sig == SIGTERM) {
+		exit_requested = 1;
+	}
+}
+
+static void install_signal_handlers(bool checkpointing) {
+	struct sigaction sa = {0};
+	sa.sa_handler = handle_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGUSR1, &sa, NULL);
+	if (checkpointing) {
+		sigaction(SIGALRM, &sa, NULL);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		alarm(checkpoint_interval);
+	}
+}
+
+// No solution was found without ever running into the depth limit, so going deeper won't find one either
+static void finish_map(u32 index, bool cut_off, size_t pending_before, u64 discovery, size_t player) {
+	if (cut_off) {
+		while (pending_size > pending_before) {
+			pending_discoveries[pending[--pending_size]] = 0;
+		}
+		return;
+	}
+
+	if (shallowest_cycle < discovery) {
+		pending_discoveries[index] = discovery;
+		pending[pending_size++] = index;
+		return;
+	}
+
+	map_budgets[index] = DEADLOCKED;
+	while (pending_size > pending_before) {
+		u32 p = pending[--pending_size];
+		pending_discoveries[p] = 0;
+		map_budgets[p] = DEADLOCKED;
+	}
+
+	if (use_deadlocks) {
+		deadlock_learn(&deadlocks, box_tiles, player);
+	}
+}
+
+// The memo table is kept across iterations: a map that was already searched
+// with at least as many moves to spare can't lead to a solution this time either
+// Returns whether the moves from this map should be searched, in which case leave() has to be called afterwards
+static bool enter(struct frame *f, size_t depth) {
 	current_solve_calls++;
 	total_solve_calls++;
 
+	if (anytime_node(&anytime)) {
+		print_result("limit");
+		exit(EXIT_FAILURE);
+	}
+
+	if (benchmarking && !bench_recording(&bench)) {
+		return false;
+	}
+
+	if (empty_storages < best_empty_storages) {
+		best_empty_storages = empty_storages;
+		memcpy(best_path, path, path_length);
+		best_path_length = path_length;
+	}
+
+	f->cutoffs_before = cutoffs;
+
 	if (depth > max_depth) {
-		return;
+		cutoffs++;
+		return false;
 	}
 
-	stringify_map();
+	// Every push that the matching says is still needed takes at least one move
+	if (use_matching && (size_t)matching.total > max_depth - depth + 1) {
+		cutoffs += matching.total < MATCHING_UNREACHABLE;
+		return false;
+	}
+	if (use_nearest && nearest_total > max_depth - depth + 1) {
+		cutoffs++;
+		return false;
+	}
+
+	if (checkpoint_requested) {
+		write_checkpoint(depth);
+	}
+
+	key_map();
+
+	i32 budget = max_depth - depth;
 
 	u32 bucket_index = elf_hash(map_string) % MAX_MAPS;
 
 	u32 i = buckets[bucket_index];
+	u32 index;
 
 	while (true) {
-		if (i == UINT32_MAX) {
+		if (i == 0) {
+			if (maps_size == MAX_MAPS || map_strings_size + map_string_length+1 > MAX_MAP_STRINGS_CHARS) {
+				fprintf(stderr, "The memo table is full! You need to up the MAX_MAPS and MAX_MAP_STRINGS_CHARS #defines\n");
+				exit(EXIT_FAILURE);
+			}
+
 			// fprintf(stderr, "Memoizing map:\n%.*s\n", (int)map_string_length, map_string);
-			maps[maps_size] = map_strings + map_strings_size;
-			map_depths[maps_size] = depth;
+			map_offsets[maps_size] = map_strings_size;
+			map_budgets[maps_size] = budget;
 			memcpy(map_strings + map_strings_size, map_string, map_string_length+1);
 			map_strings_size += map_string_length+1;
 
 			// If this map hasn't been seen before, memoize it
 			chains[maps_size] = buckets[bucket_index];
-			buckets[bucket_index] = maps_size++;
+			buckets[bucket_index] = maps_size;
+			in_progress[depth] = (struct in_progress){.index=maps_size, .previous_budget=-1};
+			index = maps_size++;
+
+			if (maps_size >= pages.next_promote) {
+				pages_promote(&pages, maps_size);
+			}
 
 			break;
 		}
 
-		if (strcmp(map_string, maps[i]) == 0) {
-			if (depth < map_depths[i]) {
-				map_depths[i] = depth;
+		if (strcmp(map_string, map_strings + map_offsets[i]) == 0) {
+			// A pending map didn't run into the depth limit, so searching it again with more moves to spare is pointless
+			if (pending_discoveries[i] != 0) {
+				shallowest_cycle = pending_discoveries[i] < shallowest_cycle ? pending_discoveries[i] : shallowest_cycle;
+				return false;
+			}
+
+			if (budget > map_budgets[i]) {
+				in_progress[depth] = (struct in_progress){.index=i, .previous_budget=map_budgets[i]};
+				map_budgets[i] = budget;
+				index = i;
 				break;
 			} else {
-				return; // Memoization, by stopping if the map_string has been seen before
+				// A map that is still being searched higher up means the search went in a circle,
+				// which says nothing about the depth limit
+				size_t ancestor = max_depth - map_budgets[i];
+				if (map_budgets[i] != DEADLOCKED && ancestor < depth && in_progress[ancestor].index == i) {
+					shallowest_cycle = frames[ancestor].discovery < shallowest_cycle ? frames[ancestor].discovery : shallowest_cycle;
+				} else {
+					cutoffs += map_budgets[i] != DEADLOCKED;
+				}
+				return false; // Memoization, by stopping if the map_string has been searched at least this deep before
 			}
 		}
 
 		i = chains[i];
 	}
 
-	up(depth);
-	down(depth);
-	left(depth);
-	right(depth);
+	f->index = index;
+	f->discovery = ++discoveries;
+	f->outer_cycle = shallowest_cycle;
+	shallowest_cycle = UINT64_MAX;
+	f->pending_before = pending_size;
+	f->direction = 0;
+	f->moved = false;
+
+	size_t sample = benchmarking ? bench_slot(&bench) : SIZE_MAX;
+	if (sample != SIZE_MAX) {
+		struct bench_state *b = &bench_states[sample];
+		memcpy(b->map, map, height * sizeof(map[0]));
+		b->player_x = player_x;
+		b->player_y = player_y;
+		b->empty_storages = empty_storages;
+	}
+	return true;
 }
 
-static void reset(void) {
-	maps_size = 0;
-	map_string_length = 0;
-	map_strings_size = 0;
-	current_solve_calls = 0;
-	memset(buckets, UINT32_MAX, MAX_MAPS * sizeof(u32));
+static void leave(const struct frame *f) {
+	finish_map(f->index, cutoffs != f->cutoffs_before, f->pending_before, f->discovery, player_x + player_y * width);
+
+	shallowest_cycle = shallowest_cycle < f->outer_cycle ? shallowest_cycle : f->outer_cycle;
 }
 
-int main(void) {
-	size_t n = 1;
-	char *line = malloc(n);
-	while (getline(&line, &n, stdin) > 0) {
-		if (line[0] == '%' || isspace(line[0])) { // If this line is a comment or whitespace
+static bool (*const moves[4])(struct frame *f) = {up, down, left, right};
+static void (*const undo_moves[4])(const struct frame *f) = {undo_up, undo_down, undo_left, undo_right};
+
+// A depth-first search that keeps its frames in an array instead of on the C stack,
+// so max_depth is only limited by MAX_PATH_LENGTH, and the whole search state can be inspected at any point
+static void solve(void) {
+	size_t depth = 1;
+	if (!enter(&frames[depth], depth)) {
+		return;
+	}
+
+	while (depth > 0) {
+		struct frame *f = &frames[depth];
+
+		if (f->moved) {
+			undo_moves[f->direction - 1](f);
+			f->moved = false;
+		}
+
+		if (f->direction == 4) {
+			leave(f);
+			depth--;
 			continue;
 		}
 
-		size_t len = 0;
-		while (line[len] != '\n') {
-			char c = line[len];
+		f->moved = moves[f->direction++](f);
+		if (f->moved && !f->deadlocked && enter(&frames[depth + 1], depth + 1)) {
+			depth++;
+		}
+	}
+}
+
+static bool is_wall(size_t x, size_t y) {
+	return x >= width || y >= height || map[y][x] == WALL; // x-1 and y-1 wrap around when they go below 0
+}
+
+static size_t count_tiles(bool (*counts)(enum tile)) {
+	size_t count = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			count += counts(map[y][x]);
+		}
+	}
+	return count;
+}
+
+static bool is_box(enum tile t) {
+	return t == BOX || t == STORED_BOX;
+}
+
+static void preprocess(void) {
+	struct preprocess p = {.map=map, .frozen=frozen, .width=width, .height=height, .player_x=player_x, .player_y=player_y};
+	preprocess_level(&p);
+	width = p.width;
+	height = p.height;
+	player_x = p.player_x;
+	player_y = p.player_y;
+	origin_x = p.origin_x;
+	origin_y = p.origin_y;
+}
+
+// Numbers the floor tiles that are left after preprocessing, and picks the shortest key for the level
+static void init_keys(void) {
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] != WALL) {
+				floor_indices[y][x] = floors_size;
+				floor_x[floors_size] = x;
+				floor_y[floors_size] = y;
+				floors_size++;
+			}
+		}
+	}
+	key_init(&key_format, floors_size, count_tiles(is_box));
+}
+
+// The push distances, and the tiles that are dead, see preprocess.h
+static void init_distances(void) {
+	struct preprocess p = {.map=map, .frozen=frozen, .width=width, .height=height};
+	bool stuck;
+	use_nearest = preprocess_dead_tiles(&p, &distances, dead_tiles, &stuck);
+	if (stuck) {
+		fprintf(stderr, "A box is on a tile that no storage can be reached from, so no solution exists :(\n");
+		print_result("unsolved");
+		exit(EXIT_FAILURE);
+	}
+
+	nearest_total = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (is_box(map[y][x])) {
+				nearest_total += distances.nearest[x + y * width];
+			}
+		}
+	}
+}
+
+static void init_matching(void) {
+	size_t storages = 0;
+	size_t boxes = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			storages += map[y][x] == STORAGE || map[y][x] == STORED_BOX;
+			boxes += map[y][x] == BOX || map[y][x] == STORED_BOX;
+		}
+	}
+	if (storages == 0 || storages > boxes || boxes > MATCHING_MAX) {
+		printf("matching lower bound: disabled for %zu storages and %zu boxes\n\n", storages, boxes);
+		return;
+	}
+
+	matching.rows = storages;
+	matching.cols = 0;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] == BOX || map[y][x] == STORED_BOX) {
+				box_ids[y][x] = ++matching.cols;
+				for (size_t i = 0; i < matching.rows; i++) {
+					matching.cost[i + 1][matching.cols] = push_cost(x + y * width, i);
+				}
+			}
+		}
+	}
+
+	matching_solve(&matching);
+	use_matching = true;
+	use_nearest = false;
+
+	printf("matching lower bound: %d pushes\n\n", matching.total);
+
+	if (matching.total >= MATCHING_UNREACHABLE) {
+		fprintf(stderr, "The boxes can't all be pushed onto a storage, so no solution exists :(\n");
+		print_result("unsolved");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void save_deadlocks(void) {
+	if (!deadlock_save(&deadlocks, deadlocks_path, level_hash)) {
+		perror(deadlocks_path);
+	}
+}
+
+static void init_deadlocks(void) {
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			if (map[y][x] == BOX || map[y][x] == STORED_BOX) {
+				deadlock_add(box_tiles, x + y * width);
+			}
+		}
+	}
+
+	// Removing boxes only makes a map easier when every box has to end up on a storage
+	if (!use_matching || matching.rows != matching.cols) {
+		printf("deadlock learning: disabled, since not every box has a storage\n\n");
+		return;
+	}
+
+	u64 walls[DEADLOCK_WORDS] = {0};
+	u64 storages[DEADLOCK_WORDS] = {0};
+	u64 dead[DEADLOCK_WORDS] = {0};
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			size_t tile = x + y * width;
+			if (is_wall(x, y)) {
+				deadlock_add(walls, tile);
+				continue;
+			}
+			if (map[y][x] == STORAGE || map[y][x] == STORED_BOX) {
+				deadlock_add(storages, tile);
+			}
+
+			if (distances_dead(&distances, tile)) {
+				deadlock_add(dead, tile);
+			}
+		}
+	}
+
+	// Tiles are numbered with the cropped width, so that a small map only needs a few words per set of tiles
+	deadlock_init(&deadlocks, width, width * height, walls, storages, dead);
+	use_deadlocks = true;
+
+	if (deadlocks_path) {
+		enum deadlock_file loaded = deadlock_load(&deadlocks, deadlocks_path, level_hash);
+		if (loaded == DEADLOCK_FILE_LOADED) {
+			printf("deadlock learning: loaded %zu patterns from '%s'\n\n", deadlocks.patterns_size, deadlocks_path);
+		}
+		if (loaded == DEADLOCK_FILE_OTHER) {
+			// The file may well be another level's, or another solver's, which it's not up to this run to overwrite
+			fprintf(stderr, "'%s' isn't a deadlock file of this level, so it's left as it is\n", deadlocks_path);
+		} else {
+			atexit(save_deadlocks);
+		}
+	}
+}
+
+static void bench_load(size_t sample) {
+	const struct bench_state *b = &bench_states[sample];
+	memcpy(map, b->map, height * sizeof(map[0]));
+	player_x = b->player_x;
+	player_y = b->player_y;
+	empty_storages = b->empty_storages;
+	path_length = 0;
+}
+
+static void bench_load_key(size_t sample) {
+	bench_load(sample);
+	key_map();
+}
+
+static void bench_key_map(size_t sample) {
+	(void)sample;
+	key_map();
+}
+
+static volatile u32 bench_hash_sink;
+
+static void bench_elf_hash(size_t sample) {
+	(void)sample;
+	bench_hash_sink = elf_hash(map_string);
+}
+
+static void bench_moves(size_t sample) {
+	(void)sample;
+	struct frame f;
+	for (size_t d = 0; d < 4; d++) {
+		if (moves[d](&f)) {
+			undo_moves[d](&f);
+		}
+	}
+}
+
+// Records maps from the first BENCH_RECORD_NODES maps the search visits, and benchmarks the kernels on them
+static void run_benchmarks(void) {
+	for (max_depth = 1; max_depth < MAX_PATH_LENGTH; max_depth++) {
+		solve();
+		if (!bench_recording(&bench) || map_budgets[frames[1].index] == DEADLOCKED) {
+			break;
+		}
+	}
+	printf("bench: recorded %zu out of %zu searched maps, up to max_depth %zu\n", bench.samples, bench.seen, max_depth);
+
+	// The matching and the box tiles can't follow the recorded maps being swapped in
+	use_matching = false;
+	use_nearest = false;
+	use_deadlocks = false;
+
+	bench_run(&bench, "key_map()", bench_load, bench_key_map);
+	bench_run(&bench, "elf_hash()", bench_load_key, bench_elf_hash);
+	bench_run(&bench, "up/down/left/right() + undo", bench_load, bench_moves);
+}
+
+// Replays a cached solution onto the map, so that a hit prints the solved map like a search would
+// Returns false and leaves the map alone when the path doesn't solve the level
+static bool replay_cached_path(const char *cached_path) {
+	static enum tile replayed[MAX_HEIGHT][MAX_WIDTH];
+	memcpy(replayed, map, sizeof(map));
+	struct preprocess p = {.map=replayed, .frozen=frozen, .width=width, .height=height, .player_x=player_x, .player_y=player_y};
+	for (const char *c = cached_path; *c != '\0'; c++) {
+		char move = tolower(*c);
+		if (!preprocess_replay_move(&p, move == 'l' ? -1 : move == 'r', move == 'u' ? -1 : move == 'd', isupper(*c))) {
+			return false;
+		}
+	}
+	if (preprocess_empty_storages(&p) > 0) {
+		return false;
+	}
+	memcpy(map, replayed, sizeof(map));
+	player_x = p.player_x;
+	player_y = p.player_y;
+	empty_storages = 0;
+	return true;
+}
+
+// Looks the level up in the cache, and exits with its result if it's there
+static void use_cached_result(void) {
+	if (!cache.path) {
+		return;
+	}
+
+	stringify_map();
+	cache.key = cache_hash(map_string);
+
+	char *cached_path;
+	const char *status = cache_lookup(&cache, &cached_path);
+	if (!status) {
+		return;
+	}
+	// An entry that was cut off, mangled, or doesn't solve the level is treated as a miss, rather than overrunning path
+	if (strlen(cached_path) >= MAX_PATH_LENGTH || cached_path[strspn(cached_path, "udlrUDLR")] != '\0' || (strcmp(status, "solved") == 0 && !replay_cached_path(cached_path))) {
+		printf("cache: ignoring the level's path in '%s', which is malformed or doesn't solve it\n", cache.path);
+		free(cached_path);
+		return;
+	}
+	printf("cache: found the level in '%s'\n", cache.path);
+	from_cache = true;
+	path_length = strlen(cached_path);
+	memcpy(path, cached_path, path_length);
+	free(cached_path);
+	max_depth = path_length;
+
+	if (strcmp(status, "solved") == 0) {
+		printf("Solved!\n");
+		print_map();
+		print_result("solved");
+		exit(EXIT_SUCCESS);
+	}
+	fprintf(stderr, "No solution was found :(\n");
+	print_result("unsolved");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	bool resume = false;
+	bool checkpointing = false;
+	size_t level_number = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--resume") == 0) {
+			resume = true;
+		} else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+			checkpoint_path = argv[++i];
+			checkpointing = true;
+		} else if (strcmp(argv[i], "--deadlocks") == 0 && i + 1 < argc) {
+			deadlocks_path = argv[++i];
+		} else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc) {
+			checkpoint_interval = strtoul(argv[++i], NULL, 10);
+			checkpointing = true;
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			benchmarking = true;
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			perf_open(&perf);
+		} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			cache.path = argv[++i];
+		} else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+			level_number = strtoull(argv[++i], NULL, 10);
+		} else if (!anytime_parse(&anytime, argc, argv, &i)) {
+			fprintf(stderr, "Usage: %s [--checkpoint path] [--checkpoint-interval seconds] [--resume] [--deadlocks path] [--max-nodes n] [--timeout seconds] [--max-memory MiB] [--level n] [--cache path] [--perf] [--bench] < levels.txt\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	perf_begin(&perf, 0);
+
+	struct levels collection;
+	if (!levels_open(&collection, STDIN_FILENO) || level_number == 0 || level_number > collection.levels_size) {
+		fprintf(stderr, "--level has to be between 1 and the %zu levels of the input\n", collection.levels_size);
+		exit(EXIT_FAILURE);
+	}
+	levels_print(&collection, level_number);
+	const struct level *level = &collection.levels[level_number - 1];
+	const char *cursor = level->start;
+	char row[MAX_WIDTH];
+	size_t len;
+	while (level_next_row(level, &cursor, row, MAX_WIDTH, &len)) {
+		for (size_t x = 0; x < len && x < MAX_WIDTH && height < MAX_HEIGHT; x++) {
+			char c = row[x];
 			if (c == '@' || c == '+') {
-				player_x = len;
+				player_x = x;
 				player_y = height;
 				if (c == '+') {
 					empty_storages++;
-					map[height][len] = STORAGE;
+					map[height][x] = STORAGE;
 				}
 			} else {
 				enum tile t = char_to_tile(c);
 				if (t == STORAGE) {
 					empty_storages++;
 				}
-				map[height][len] = t;
+				map[height][x] = t;
 			}
-			len++;
 		}
 		width = len > width ? len : width;
 		height++;
 	}
-	free(line);
+	levels_close(&collection);
+
+	anytime_start(&anytime);
+
+	if (width > MAX_WIDTH || height > MAX_HEIGHT) {
+		fprintf(stderr, "The map exceeds %s\n", width > MAX_WIDTH ? "MAX_WIDTH" : "MAX_HEIGHT");
+		print_result("error");
+		exit(EXIT_FAILURE);
+	}
+
+	preprocess();
+	init_keys();
+	best_empty_storages = empty_storages;
+
+	use_cached_result();
 
 	print_map();
 	check_is_solved();
 
+	init_distances();
+	init_matching();
+
+	stringify_map();
+	level_hash = elf_hash(map_string);
+
+	init_deadlocks();
+
+	if (resume) {
+		load_checkpoint();
+	} else {
+		allocate_tables();
+	}
+	pending_discoveries = pages_map(&pages, MAX_MAPS * sizeof(u64));
+	install_signal_handlers(checkpointing);
+	perf_end(&perf, "parse", 0);
+
+	if (benchmarking) {
+		run_benchmarks();
+		exit(EXIT_SUCCESS);
+	}
+
 	// See https://en.wikipedia.org/wiki/Iterative_deepening_depth-first_search
 	// max_depth = 122; {
 	for (;; max_depth++) {
 		fprintf(stderr, "max_depth: %zu\n", max_depth);
-		reset();
-		solve(1);
+		perf_begin(&perf, anytime.nodes);
+		solve();
+		char phase[64];
+		snprintf(phase, sizeof(phase), "depth %zu", max_depth);
+		perf_end(&perf, phase, anytime.nodes);
 		print_iddfs_stats();
+		current_solve_calls = 0;
+
+		// The start itself is deadlocked, so no depth is ever going to be enough
+		if (map_budgets[frames[1].index] == DEADLOCKED) {
+			break;
+		}
 	}
 
 	fprintf(stderr, "No solution was found :(\n");
+	print_result("unsolved");
 	exit(EXIT_FAILURE);
 }
@@ -0,0 +1,74 @@
+// Memo keys that only hold what can change between the maps of a level: which floor tiles have a box on them, and where the player is
+//
+// A level with few boxes on lots of floor is keyed by the list of its boxes' floor tiles, two chars each,
+// and one with lots of boxes by a bitset of its floor tiles, seven to a char, whichever is shorter for the level.
+// The player's floor tile takes two more chars. No char is ever 0, so a key is still a C string
+// that the memo tables hash and compare just like the map strings they replace, which grow with the width times the height instead
+
+#ifndef KEY_H
+#define KEY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define KEY_MAX_FLOORS 4096
+#define KEY_MAX_LENGTH ((KEY_MAX_FLOORS + 6) / 7 + 3) // The bitset, the player, and the '\0'
+
+struct key_format {
+	size_t floors;
+	bool box_list;
+	size_t length; // Without the '\0'
+};
+
+static void key_init(struct key_format *k, size_t floors, size_t boxes) {
+	size_t bitset_length = (floors + 6) / 7;
+	k->floors = floors;
+	k->box_list = 2 * boxes < bitset_length;
+	k->length = (k->box_list ? 2 * boxes : bitset_length) + 2;
+}
+
+static void key_put_floor(unsigned char *key, size_t floor) {
+	key[0] = 1 + floor / 255;
+	key[1] = 1 + floor % 255;
+}
+
+static inline size_t key_get_floor(const unsigned char *key) {
+	return (key[0] - 1) * 255 + key[1] - 1;
+}
+
+// Writes the key of a map, where box_floors are the floor tiles that have a box on them, from low to high
+static void key_encode(const struct key_format *k, char *key, const uint16_t *box_floors, size_t boxes, size_t player) {
+	unsigned char *u = (unsigned char *)key;
+	if (k->box_list) {
+		for (size_t i = 0; i < boxes; i++) {
+			key_put_floor(u + 2 * i, box_floors[i]);
+		}
+	} else {
+		memset(u, 0x80, k->length - 2);
+		for (size_t i = 0; i < boxes; i++) {
+			u[box_floors[i] / 7] |= 1 << (box_floors[i] % 7);
+		}
+	}
+	key_put_floor(u + k->length - 2, player);
+	u[k->length] = '\0';
+}
+
+// Reads back which floor tiles have a box on them, and returns the player's floor tile
+static inline size_t key_decode(const struct key_format *k, const char *key, bool *has_box) {
+	const unsigned char *u = (const unsigned char *)key;
+	if (k->box_list) {
+		memset(has_box, false, k->floors);
+		for (size_t i = 0; i + 2 < k->length; i += 2) {
+			has_box[key_get_floor(u + i)] = true;
+		}
+	} else {
+		for (size_t floor = 0; floor < k->floors; floor++) {
+			has_box[floor] = (u[floor / 7] >> (floor % 7)) & 1;
+		}
+	}
+	return key_get_floor(u + k->length - 2);
+}
+
+#endif
@@ -0,0 +1,328 @@
+// Level collections, like the ones that are published as a single text file with thousands of levels
+//
+// The whole input is mmapped when it's a file, or read into memory when it's a pipe or a socket,
+// and split into lines by levels_scan_line(), which looks at 16 chars at a time with SSE2.
+// Every line is one of:
+// - a row, which only has the chars of a level in it, and at least one wall
+// - blank, which ends a level
+// - a comment, which starts with '%' or ';', and is skipped, so a comment between the rows of a level doesn't split it
+// - text, like "Title: Bounce" or "Author: ...", where "Title:" names the level it's right after, or else the next one,
+//   and anything else that isn't "Key: value" names the next level, like "Level 12" does
+//
+// A level only points to its rows in the input, so nothing is copied until level_next_row() writes a row out.
+// That's also where run-length encoded rows like "3#|#@$.#|3#" get expanded, where a count repeats the char after it,
+// and '|' ends a row. '-' and '_' are floor, like ' ', since collections use them when trailing spaces would get lost
+
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum levels_line {
+	LEVELS_ROW,
+	LEVELS_BLANK,
+	LEVELS_COMMENT,
+	LEVELS_TEXT,
+};
+
+struct level {
+	const char *title; // Points into the input, or NULL
+	size_t title_length;
+	const char *start; // The first row
+	const char *end; // Just past the newline of the last row
+};
+
+struct levels {
+	char *data;
+	size_t size;
+	bool mapped; // Whether data is mmapped, instead of malloced
+
+	struct level *levels;
+	size_t levels_size;
+	size_t levels_capacity;
+};
+
+static bool levels_is_row_char(unsigned char c) {
+	return (c != 0 && strchr("#@+$*.-_ |\r", c) != NULL) || (c >= '0' && c <= '9');
+}
+
+// Returns the end of the line that starts at p, which is its '\n' or end, and classifies it
+static const char *levels_scan_line(const char *p, const char *end, enum levels_line *line) {
+	unsigned not_row = 0; // Chars that can't be in a row
+	unsigned walls = 0;
+	unsigned not_blank = 0;
+	const char *start = p;
+
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i carriage_return = _mm_set1_epi8('\r');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i wall = _mm_set1_epi8('#');
+	const __m128i below_digits = _mm_set1_epi8('0' - 1);
+	const __m128i above_digits = _mm_set1_epi8('9' + 1);
+	static const char others[] = "@+$*.-_|";
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i is_wall = _mm_cmpeq_epi8(v, wall);
+		__m128i is_space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, carriage_return)), _mm_cmpeq_epi8(v, tab));
+		__m128i is_row = _mm_and_si128(_mm_cmpgt_epi8(v, below_digits), _mm_cmplt_epi8(v, above_digits));
+		is_row = _mm_or_si128(is_row, _mm_or_si128(is_wall, is_space));
+		for (size_t i = 0; i < sizeof(others) - 1; i++) {
+			is_row = _mm_or_si128(is_row, _mm_cmpeq_epi8(v, _mm_set1_epi8(others[i])));
+		}
+		is_row = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), is_row); // A tab only counts as blank
+
+		unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+		unsigned before = newlines ? (newlines & -newlines) - 1 : 0xffff; // The chars before the first newline
+		not_row |= ~_mm_movemask_epi8(is_row) & ~newlines & before;
+		walls |= _mm_movemask_epi8(is_wall) & before;
+		not_blank |= ~_mm_movemask_epi8(is_space) & ~newlines & before;
+		if (newlines) {
+			p += __builtin_ctz(newlines);
+			break;
+		}
+		p += 16;
+	}
+#endif
+
+	// The rest of a line that's too close to the end for 16 chars, and every line without SSE2
+	for (; p < end && *p != '\n'; p++) {
+		not_row |= !levels_is_row_char(*p);
+		walls |= *p == '#';
+		not_blank |= *p != ' ' && *p != '\r' && *p != '\t';
+	}
+
+	if (!not_blank) {
+		*line = LEVELS_BLANK;
+	} else if (*start == '%' || *start == ';') {
+		*line = LEVELS_COMMENT;
+	} else if (!not_row && walls) {
+		*line = LEVELS_ROW;
+	} else {
+		*line = LEVELS_TEXT;
+	}
+	return p;
+}
+
+// Whether the text is like "Author: someone", and returns what comes after the colon in value
+static bool levels_key(const char *p, const char *end, const char *key, const char **value) {
+	const char *colon = p;
+	while (colon < end && (isalnum((unsigned char)*colon) || *colon == ' ') && colon - p < 32) {
+		colon++;
+	}
+	if (colon == p || colon == end || *colon != ':') {
+		return false;
+	}
+	*value = colon + 1;
+	while (*value < end && **value == ' ') {
+		(*value)++;
+	}
+	return key == NULL || ((size_t)(colon - p) == strlen(key) && strncasecmp(p, key, colon - p) == 0);
+}
+
+static void levels_add(struct levels *l, const char *start, const char *title, size_t title_length) {
+	if (l->levels_size == l->levels_capacity) {
+		l->levels_capacity = l->levels_capacity == 0 ? 64 : 2 * l->levels_capacity;
+		l->levels = realloc(l->levels, l->levels_capacity * sizeof(struct level));
+		if (!l->levels) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	l->levels[l->levels_size++] = (struct level){.title=title, .title_length=title_length, .start=start, .end=start};
+}
+
+static void levels_split(struct levels *l) {
+	const char *end = l->data + l->size;
+	const char *title = NULL; // The text that names the next level
+	size_t title_length = 0;
+	bool in_level = false;
+
+	for (const char *p = l->data; p < end;) {
+		enum levels_line line;
+		const char *line_end = levels_scan_line(p, end, &line);
+		const char *next = line_end < end ? line_end + 1 : end;
+		size_t length = line_end - p;
+		while (length > 0 && (p[length - 1] == '\r' || p[length - 1] == ' ')) {
+			length--;
+		}
+
+		struct level *last = l->levels_size > 0 ? &l->levels[l->levels_size - 1] : NULL;
+		const char *value;
+		if (line == LEVELS_ROW) {
+			if (!in_level) {
+				levels_add(l, p, title, title_length);
+				title = NULL;
+				in_level = true;
+			}
+			l->levels[l->levels_size - 1].end = next;
+		} else if (line == LEVELS_BLANK) {
+			in_level = false;
+		} else if (line == LEVELS_COMMENT) {
+			// Only a level's rows are copied, so level_next_row() skips the comments between them
+		} else if (levels_key(p, p + length, "Title", &value)) {
+			// Right after the rows it's the title of those, and otherwise of the rows that come next
+			if (last && last->end == p) {
+				last->title = value;
+				last->title_length = p + length - value;
+			} else {
+				title = value;
+				title_length = p + length - value;
+			}
+			in_level = false;
+		} else {
+			if (!levels_key(p, p + length, NULL, &value)) {
+				title = p;
+				title_length = length;
+			}
+			in_level = false;
+		}
+
+		p = next;
+	}
+}
+
+// Loads every level from fd, and returns whether there was at least one
+static bool levels_open(struct levels *l, int fd) {
+	memset(l, 0, sizeof(*l));
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		l->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		if (l->data != MAP_FAILED) {
+			l->size = st.st_size;
+			l->mapped = true;
+			madvise(l->data, l->size, MADV_SEQUENTIAL);
+		}
+	}
+
+	if (!l->mapped) {
+		size_t capacity = 1 << 16;
+		l->data = malloc(capacity);
+		ssize_t n;
+		while (l->data && (n = read(fd, l->data + l->size, capacity - l->size)) > 0) {
+			l->size += n;
+			if (l->size == capacity) {
+				capacity *= 2;
+				l->data = realloc(l->data, capacity);
+			}
+		}
+		if (!l->data) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	levels_split(l);
+	return l->levels_size > 0;
+}
+
+static void levels_close(struct levels *l) {
+	if (l->mapped) {
+		munmap(l->data, l->size);
+	} else {
+		free(l->data);
+	}
+	free(l->levels);
+	memset(l, 0, sizeof(*l));
+}
+
+// Says which level of a collection is solved, which a single level without a title doesn't need
+static inline void levels_print(const struct levels *l, size_t number) {
+	const struct level *level = &l->levels[number - 1];
+	if (l->levels_size > 1 || level->title) {
+		printf("level: %zu of %zu", number, l->levels_size);
+		if (level->title) {
+			printf(", '%.*s'", (int)level->title_length, level->title);
+		}
+		printf("\n");
+	}
+}
+
+// Writes the next row of the level at *cursor into row, expanding run lengths, and turning '-' and '_' into ' '
+// At most max chars are written, but length is the whole row's, so a row that's too long can still be told apart
+// Returns false once there are no rows left, where *cursor starts out as level->start
+static bool level_next_row(const struct level *level, const char **cursor, char *row, size_t max, size_t *length) {
+	// Locals, since the chars written to row could alias anything as far as the compiler knows
+	const char *p = *cursor;
+	const char *end = level->end;
+	while (p < end && (*p == '%' || *p == ';')) {
+		const char *newline = memchr(p, '\n', end - p);
+		p = newline ? newline + 1 : end;
+	}
+	if (p >= end) {
+		return false;
+	}
+
+	size_t n = 0;
+	size_t count = 0;
+#ifdef __SSE2__
+	// Plain chars, up to the first one that needs a look, are copied 16 at a time
+	while (end - p >= 16 && n + 16 <= max) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i special = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+		special = _mm_or_si128(special, _mm_cmplt_epi8(v, _mm_set1_epi8(' '))); // '\n' and '\r'
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+		unsigned mask = _mm_movemask_epi8(special);
+		_mm_storeu_si128((__m128i *)(row + n), v);
+		size_t plain = mask ? (size_t)__builtin_ctz(mask) : 16;
+		n += plain;
+		p += plain;
+		if (mask) {
+			break;
+		}
+	}
+#endif
+	for (; p < end && *p != '\n' && *p != '|'; p++) {
+		char c = *p;
+		if (c >= '0' && c <= '9') {
+			count = 10 * count + (c - '0');
+			continue;
+		}
+		if (c == '\r') {
+			continue;
+		}
+		if (c == '-' || c == '_') {
+			c = ' ';
+		}
+		if (count == 0) {
+			if (n < max) {
+				row[n] = c;
+			}
+			n++;
+			continue;
+		}
+		if (n < max) {
+			memset(row + n, c, n + count <= max ? count : max - n);
+		}
+		n += count;
+		count = 0;
+	}
+	// Trailing floor is the same as no floor
+	while (n > 0 && n <= max && row[n - 1] == ' ') {
+		n--;
+	}
+
+	*length = n;
+	*cursor = p < end ? p + 1 : p;
+	return true;
+}
+
+#endif
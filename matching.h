@@ -0,0 +1,181 @@
+// Minimum-cost matching of storages to boxes, where the cost is the number of pushes needed to get a box onto a storage
+// Its cost is a lower bound on the number of pushes that are still needed to solve the map
+//
+// The matching is computed once with the Hungarian algorithm from https://cp-algorithms.com/graph/hungarian-algorithm.html,
+// which runs in O(n^3). When a single box moves, only its column of costs changes,
+// so its storage is unmatched and rematched with one augmenting path, which runs in O(n^2)
+
+#ifndef MATCHING_H
+#define MATCHING_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MATCHING_MAX 64
+
+// The cost of a storage that a box can't ever be pushed onto
+// Any matching that costs at least this much means the map is deadlocked
+#define MATCHING_UNREACHABLE 100000
+
+#define MATCHING_MAX_POTENTIAL (1LL << 48)
+
+struct matching {
+	size_t rows; // Storages
+	size_t cols; // Boxes, of which there are at least as many as storages
+
+	// Everything is 1-based, since row and column 0 are used by the algorithm
+	int cost[MATCHING_MAX + 1][MATCHING_MAX + 1];
+	// Every repair shifts the potentials by up to MATCHING_UNREACHABLE, which adds up past an int,
+	// so they're long long, and get reset by solving from scratch once they grow past MATCHING_MAX_POTENTIAL
+	long long u[MATCHING_MAX + 1];
+	long long v[MATCHING_MAX + 1];
+	int row_of[MATCHING_MAX + 1]; // The row that each column is matched with, or 0
+
+	int total; // At most MATCHING_UNREACHABLE, so unreachable pairs don't keep adding up
+};
+
+// Everything matching_move_box() changes, so it can be undone without repairing the matching again
+struct matching_undo {
+	size_t col;
+	int cost[MATCHING_MAX + 1];
+	long long u[MATCHING_MAX + 1];
+	long long v[MATCHING_MAX + 1];
+	int row_of[MATCHING_MAX + 1];
+	int total;
+};
+
+// Finds the shortest augmenting path from an unmatched row, and flips the path
+static void matching_augment(struct matching *m, int row) {
+	long long minv[MATCHING_MAX + 1];
+	bool used[MATCHING_MAX + 1];
+	size_t way[MATCHING_MAX + 1];
+	for (size_t j = 0; j <= m->cols; j++) {
+		minv[j] = LLONG_MAX;
+		used[j] = false;
+	}
+
+	m->row_of[0] = row;
+	size_t j0 = 0;
+	do {
+		used[j0] = true;
+		int i0 = m->row_of[j0];
+		long long delta = LLONG_MAX;
+		size_t j1 = 0;
+		for (size_t j = 1; j <= m->cols; j++) {
+			if (!used[j]) {
+				long long cur = m->cost[i0][j] - m->u[i0] - m->v[j];
+				if (cur < minv[j]) {
+					minv[j] = cur;
+					way[j] = j0;
+				}
+				if (minv[j] < delta) {
+					delta = minv[j];
+					j1 = j;
+				}
+			}
+		}
+		for (size_t j = 0; j <= m->cols; j++) {
+			if (used[j]) {
+				m->u[m->row_of[j]] += delta;
+				m->v[j] -= delta;
+			} else {
+				minv[j] -= delta;
+			}
+		}
+		j0 = j1;
+	} while (m->row_of[j0] != 0);
+
+	do {
+		size_t j1 = way[j0];
+		m->row_of[j0] = m->row_of[j1];
+		j0 = j1;
+	} while (j0 != 0);
+	m->row_of[0] = 0;
+}
+
+static void matching_sum(struct matching *m) {
+	m->total = 0;
+	for (size_t j = 1; j <= m->cols; j++) {
+		if (m->row_of[j] != 0) {
+			m->total += m->cost[m->row_of[j]][j];
+		}
+	}
+	m->total = m->total < MATCHING_UNREACHABLE ? m->total : MATCHING_UNREACHABLE;
+}
+
+// Expects m->rows, m->cols and m->cost to have been filled in
+static void matching_solve(struct matching *m) {
+	for (size_t i = 0; i <= m->rows; i++) {
+		m->u[i] = 0;
+	}
+	for (size_t j = 0; j <= m->cols; j++) {
+		m->v[j] = 0;
+		m->row_of[j] = 0;
+	}
+
+	for (size_t i = 1; i <= m->rows; i++) {
+		matching_augment(m, i);
+	}
+
+	matching_sum(m);
+}
+
+// costs[i] is the new cost of getting the box in column col onto the storage in row i+1
+static void matching_move_box(struct matching *m, size_t col, const int *costs, struct matching_undo *undo) {
+	undo->col = col;
+	undo->total = m->total;
+	for (size_t i = 1; i <= m->rows; i++) {
+		undo->cost[i] = m->cost[i][col];
+		undo->u[i] = m->u[i];
+		m->cost[i][col] = costs[i - 1];
+	}
+	for (size_t j = 1; j <= m->cols; j++) {
+		undo->v[j] = m->v[j];
+		undo->row_of[j] = m->row_of[j];
+	}
+
+	// Lowering the column's potential keeps every edge of it feasible, and since its row gets unmatched,
+	// the only edges that have to be tight are still tight
+	long long v = 0;
+	for (size_t i = 1; i <= m->rows; i++) {
+		long long slack = m->cost[i][col] - m->u[i];
+		v = slack < v ? slack : v;
+	}
+	m->v[col] = v;
+
+	int row = m->row_of[col];
+	if (row != 0) {
+		m->row_of[col] = 0;
+		matching_augment(m, row);
+	}
+
+	// A box that is left unmatched needs a potential of 0 for the matching to be optimal,
+	// which can only happen when there are more boxes than storages
+	if (m->row_of[col] == 0 && m->v[col] != 0) {
+		matching_solve(m);
+		return;
+	}
+	for (size_t i = 1; i <= m->rows; i++) {
+		if (m->u[i] > MATCHING_MAX_POTENTIAL || m->u[i] < -MATCHING_MAX_POTENTIAL) {
+			matching_solve(m);
+			return;
+		}
+	}
+
+	matching_sum(m);
+}
+
+static void matching_undo_move(struct matching *m, const struct matching_undo *undo) {
+	for (size_t i = 1; i <= m->rows; i++) {
+		m->cost[i][undo->col] = undo->cost[i];
+		m->u[i] = undo->u[i];
+	}
+	for (size_t j = 1; j <= m->cols; j++) {
+		m->v[j] = undo->v[j];
+		m->row_of[j] = undo->row_of[j];
+	}
+	m->total = undo->total;
+}
+
+#endif
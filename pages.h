@@ -0,0 +1,225 @@
+// Memory for the big, randomly probed tables, like the memo tables, on the biggest pages the machine hands out
+//
+// With 4 KiB pages, nearly every probe of a table of hundreds of MiB is a dTLB miss on top of a cache miss.
+// Explicit huge pages (MAP_HUGETLB) are tried first, and are reserved when the table is mapped, so touching one can't fail later.
+// Most machines have none set aside, so the fallback is transparent huge pages, which the kernel hands out as it can.
+// A hash table is probed all over from the first map on, so asking for them right away would back every 2 MiB that a handful of maps touch.
+// Instead pages_promote() is called every time the number of maps doubles, and only asks for, and collapses,
+// the 2 MiB regions that at least half of the 4 KiB pages of are touched already, so they cost at most twice the memory.
+// pages_print() reports how much memory actually got which page size.
+//
+// Tables that threads on every NUMA node probe can be interleaved over the nodes,
+// while tables of a single thread are left to be placed on whichever node touches them first, which is its own.
+// Tables that forked workers probe have to be shared mappings, or every worker would get its own copy once it writes
+
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <linux/mempolicy.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PAGES_MAX_NODES 1024
+#define PAGES_MAX_TABLES 8
+#define PAGES_FIRST_PROMOTE 65536 // How many maps there have to be before the tables are first checked
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25 // Linux 6.1, which glibc doesn't know about yet
+#endif
+
+struct pages {
+	bool interleave; // Set before mapping tables that threads on every NUMA node share
+	bool shared; // Set before mapping tables that forked workers share
+	size_t huge_page_size;
+	size_t hugetlb_bytes; // Mapped with MAP_HUGETLB
+	int interleaved_nodes; // 0 if nothing was interleaved
+	size_t next_promote; // The number of maps at which pages_promote() should be called next
+
+	// The tables that are on 4 KiB pages, and can get transparent huge pages
+	void *tables[PAGES_MAX_TABLES];
+	size_t table_sizes[PAGES_MAX_TABLES];
+	size_t tables_size;
+
+	// The tables that are on explicit huge pages, so that unmapping one takes it off hugetlb_bytes
+	void *hugetlb_tables[PAGES_MAX_TABLES];
+	size_t hugetlb_tables_size;
+};
+
+// Reads a "Name: 1234 kB" line from a /proc file, as bytes, or returns 0 if it isn't there
+static size_t pages_read_kib(const char *path, const char *name) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return 0;
+	}
+	char line[256];
+	size_t kib = 0;
+	size_t name_length = strlen(name);
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, name, name_length) == 0 && line[name_length] == ':') {
+			kib = strtoull(line + name_length + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+	return kib << 10;
+}
+
+// Fills mask with the NUMA nodes that are online, like "0-1,3", and returns how many there are
+static int pages_online_nodes(unsigned long *mask) {
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+	if (!f) {
+		return 1;
+	}
+	int nodes = 0;
+	unsigned first;
+	unsigned last;
+	int c;
+	while (fscanf(f, "%u", &first) == 1) {
+		last = first;
+		c = fgetc(f);
+		if (c == '-' && fscanf(f, "%u", &last) == 1) {
+			c = fgetc(f);
+		}
+		for (unsigned node = first; node <= last && node < PAGES_MAX_NODES; node++) {
+			mask[node / (8 * sizeof(*mask))] |= 1ul << (node % (8 * sizeof(*mask)));
+			nodes++;
+		}
+		if (c != ',') {
+			break;
+		}
+	}
+	fclose(f);
+	return nodes;
+}
+
+static void pages_interleave(struct pages *p, void *t, size_t size) {
+	unsigned long mask[PAGES_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+	int nodes = pages_online_nodes(mask);
+	if (nodes < 2) {
+		return;
+	}
+	if (syscall(SYS_mbind, t, size, MPOL_INTERLEAVE, mask, PAGES_MAX_NODES, 0) == 0) {
+		p->interleaved_nodes = nodes;
+	}
+}
+
+// Maps size bytes of zeroes, which are only backed by memory once they're touched, unless they're on explicit huge pages
+static void *pages_map(struct pages *p, size_t size) {
+	if (p->huge_page_size == 0) {
+		p->huge_page_size = pages_read_kib("/proc/meminfo", "Hugepagesize");
+		if (p->huge_page_size == 0) {
+			p->huge_page_size = 2 << 20;
+		}
+		p->next_promote = PAGES_FIRST_PROMOTE;
+	}
+	size_t huge_size = (size + p->huge_page_size - 1) / p->huge_page_size * p->huge_page_size;
+	int visibility = p->shared ? MAP_SHARED : MAP_PRIVATE;
+
+	char *t = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, visibility | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (t != MAP_FAILED) {
+		p->hugetlb_bytes += huge_size;
+		if (p->hugetlb_tables_size < PAGES_MAX_TABLES) {
+			p->hugetlb_tables[p->hugetlb_tables_size++] = t;
+		}
+	} else {
+		// Transparent huge pages have to be aligned to them, so a huge page more is mapped, and the ends are cut off
+		t = mmap(NULL, huge_size + p->huge_page_size, PROT_READ | PROT_WRITE, visibility | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (t == MAP_FAILED) {
+			perror("mmap");
+			exit(EXIT_FAILURE);
+		}
+		size_t head = (p->huge_page_size - (uintptr_t)t % p->huge_page_size) % p->huge_page_size;
+		if (head > 0) {
+			munmap(t, head);
+		}
+		munmap(t + head + huge_size, p->huge_page_size - head);
+		t += head;
+
+		if (p->tables_size < PAGES_MAX_TABLES) {
+			p->tables[p->tables_size] = t;
+			p->table_sizes[p->tables_size++] = huge_size;
+		}
+	}
+
+	if (p->interleave) {
+		pages_interleave(p, t, huge_size);
+	}
+	return t;
+}
+
+// Asks for transparent huge pages for the regions of the tables that are dense enough, and has the kernel collapse them right away
+static void pages_promote(struct pages *p, size_t maps) {
+	p->next_promote = 2 * maps;
+
+	size_t small_page_size = sysconf(_SC_PAGESIZE);
+	size_t small_pages = p->huge_page_size / small_page_size;
+	unsigned char *resident = malloc(small_pages);
+	if (!resident) {
+		return;
+	}
+
+	for (size_t i = 0; i < p->tables_size; i++) {
+		for (size_t offset = 0; offset < p->table_sizes[i]; offset += p->huge_page_size) {
+			char *region = (char *)p->tables[i] + offset;
+			if (mincore(region, p->huge_page_size, resident) != 0) {
+				continue;
+			}
+			size_t touched = 0;
+			for (size_t j = 0; j < small_pages; j++) {
+				touched += resident[j] & 1;
+			}
+			// A region that is resident in full is already a huge page, or as good as one
+			if (touched * 2 >= small_pages && touched < small_pages) {
+				madvise(region, p->huge_page_size, MADV_HUGEPAGE);
+				madvise(region, p->huge_page_size, MADV_COLLAPSE); // Fails on kernels before 6.1, which leaves it to khugepaged
+			}
+		}
+	}
+	free(resident);
+}
+
+static inline void pages_unmap(struct pages *p, void *t, size_t size) {
+	if (p->huge_page_size == 0) {
+		return;
+	}
+	size_t huge_size = (size + p->huge_page_size - 1) / p->huge_page_size * p->huge_page_size;
+	for (size_t i = 0; i < p->tables_size; i++) {
+		if (p->tables[i] == t) {
+			p->tables[i] = p->tables[--p->tables_size];
+			p->table_sizes[i] = p->table_sizes[p->tables_size];
+			break;
+		}
+	}
+	for (size_t i = 0; i < p->hugetlb_tables_size; i++) {
+		if (p->hugetlb_tables[i] == t) {
+			p->hugetlb_tables[i] = p->hugetlb_tables[--p->hugetlb_tables_size];
+			p->hugetlb_bytes -= huge_size;
+			break;
+		}
+	}
+	munmap(t, huge_size);
+}
+
+static void pages_print(const struct pages *p) {
+	if (p->hugetlb_bytes > 0) {
+		printf("pages: %zu MiB of tables on %zu KiB explicit huge pages\n", p->hugetlb_bytes >> 20, p->huge_page_size >> 10);
+	}
+	if (p->tables_size > 0) {
+		// The process's other memory is small enough next to the tables to count as part of them
+		size_t huge = pages_read_kib("/proc/self/smaps_rollup", "AnonHugePages");
+		size_t anonymous = pages_read_kib("/proc/self/smaps_rollup", "Anonymous");
+		printf("pages: %zu MiB of tables on %zu KiB transparent huge pages, %zu MiB on %ld KiB pages\n",
+			huge >> 20, p->huge_page_size >> 10, (anonymous - huge) >> 20, sysconf(_SC_PAGESIZE) >> 10);
+	}
+	if (p->interleaved_nodes > 0) {
+		printf("pages: interleaved over %d NUMA nodes\n", p->interleaved_nodes);
+	}
+}
+
+#endif
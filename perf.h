@@ -0,0 +1,114 @@
+// Hardware counters around each phase of a solve, read with perf_event_open(2), so that it's visible
+// whether the time goes to the memo table (cache and dTLB misses) or to the move generation (instructions, branch misses)
+// without running an external profiler
+//
+// Only user space is counted, which perf_event_paranoid allows up to a value of 2.
+// Counters the CPU or kernel doesn't have, like in most VMs, are left out
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_COUNTERS,
+};
+
+struct perf {
+	bool enabled;
+	int fds[PERF_COUNTERS]; // -1 if the counter couldn't be opened
+	uint64_t start[PERF_COUNTERS];
+	size_t start_nodes;
+};
+
+static int perf_open_counter(uint32_t type, uint64_t config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_open(struct perf *p) {
+	p->fds[PERF_CYCLES] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	p->fds[PERF_INSTRUCTIONS] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	p->fds[PERF_CACHE_MISSES] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	p->fds[PERF_BRANCH_MISSES] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	p->fds[PERF_DTLB_MISSES] = perf_open_counter(PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+	p->enabled = false;
+	for (size_t i = 0; i < PERF_COUNTERS; i++) {
+		p->enabled |= p->fds[i] >= 0;
+	}
+	if (!p->enabled) {
+		printf("perf: no hardware counters could be opened, so they won't be reported\n\n");
+	}
+}
+
+static uint64_t perf_read(const struct perf *p, enum perf_counter counter) {
+	uint64_t value = 0;
+	if (p->fds[counter] < 0 || read(p->fds[counter], &value, sizeof(value)) != sizeof(value)) {
+		return 0;
+	}
+	return value;
+}
+
+static void perf_begin(struct perf *p, size_t nodes) {
+	if (!p->enabled) {
+		return;
+	}
+	for (size_t i = 0; i < PERF_COUNTERS; i++) {
+		p->start[i] = perf_read(p, i);
+	}
+	p->start_nodes = nodes;
+}
+
+// Prints the counters since perf_begin(), per node when there were any
+static void perf_end(struct perf *p, const char *phase, size_t nodes) {
+	if (!p->enabled) {
+		return;
+	}
+
+	static const char *names[PERF_COUNTERS] = {"cycles", "instructions", "cache misses", "branch misses", "dTLB misses"};
+	uint64_t deltas[PERF_COUNTERS];
+	for (size_t i = 0; i < PERF_COUNTERS; i++) {
+		deltas[i] = perf_read(p, i) - p->start[i];
+	}
+	nodes -= p->start_nodes;
+
+	printf("perf %s:", phase);
+	const char *separator = " ";
+	if (p->fds[PERF_CYCLES] >= 0 && p->fds[PERF_INSTRUCTIONS] >= 0 && deltas[PERF_CYCLES] > 0) {
+		printf("%s%.2f IPC", separator, (double)deltas[PERF_INSTRUCTIONS] / deltas[PERF_CYCLES]);
+		separator = ", ";
+	}
+	for (size_t i = 0; i < PERF_COUNTERS; i++) {
+		if (p->fds[i] < 0) {
+			continue;
+		}
+		if (nodes > 0) {
+			printf("%s%.2f %s/node", separator, (double)deltas[i] / nodes, names[i]);
+		} else {
+			printf("%s%llu %s", separator, (unsigned long long)deltas[i], names[i]);
+		}
+		separator = ", ";
+	}
+	printf("\n");
+}
+
+#endif
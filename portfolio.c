@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "levels.h"
+
+#define MAX_STRATEGIES 3
+#define MAX_LEVEL_LENGTH 420420
+#define POLL_INTERVAL_MS 50
+
+struct strategy {
+	const char *name;
+	const char *path;
+	bool optimal; // Whether its solution is guaranteed to be the shortest one
+
+	pid_t pid;
+	int out_fd;
+	bool running;
+
+	char *output;
+	size_t output_length;
+	size_t output_capacity;
+
+	size_t rss;
+	bool solved;
+};
+
+static struct strategy strategies[MAX_STRATEGIES] = {
+	{.name="bfs", .path="./bfs", .optimal=true},
+	{.name="iddfs", .path="./iddfs", .optimal=true},
+	{.name="area", .path="./area", .optimal=false},
+};
+
+static char level[MAX_LEVEL_LENGTH];
+static size_t level_length;
+
+static size_t max_memory;
+static double deadline;
+static bool verbose;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Only the level that is solved is handed to the strategies, with its rows expanded, so they don't each parse the whole collection
+static void read_level(size_t number) {
+	struct levels collection;
+	if (!levels_open(&collection, STDIN_FILENO) || number == 0 || number > collection.levels_size) {
+		fprintf(stderr, "--level has to be between 1 and the %zu levels of the input\n", collection.levels_size);
+		exit(EXIT_FAILURE);
+	}
+	const struct level *l = &collection.levels[number - 1];
+	const char *cursor = l->start;
+	size_t length;
+	while (level_next_row(l, &cursor, level + level_length, MAX_LEVEL_LENGTH - level_length, &length)) {
+		level_length += length;
+		if (level_length >= MAX_LEVEL_LENGTH) {
+			fprintf(stderr, "The map exceeds MAX_LEVEL_LENGTH\n");
+			exit(EXIT_FAILURE);
+		}
+		level[level_length++] = '\n';
+	}
+	levels_close(&collection);
+}
+
+static void start(struct strategy *s) {
+	int in_pipe[2];
+	int out_pipe[2];
+	if (pipe(in_pipe) != 0 || pipe(out_pipe) != 0) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	s->pid = fork();
+	if (s->pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (s->pid == 0) {
+		// Don't leave strategies running when the portfolio itself gets killed
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+		dup2(in_pipe[0], STDIN_FILENO);
+		dup2(out_pipe[1], STDOUT_FILENO);
+		if (!verbose) {
+			freopen("/dev/null", "w", stderr);
+		}
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		close(out_pipe[0]);
+		close(out_pipe[1]);
+
+		execl(s->path, s->path, (char *)NULL);
+		fprintf(stderr, "Couldn't run %s: %s\n", s->path, strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	close(in_pipe[0]);
+	close(out_pipe[1]);
+
+	// The level is tiny compared to the pipe buffer, so this won't block on the child
+	if (write(in_pipe[1], level, level_length) != (ssize_t)level_length) {
+		perror("write");
+	}
+	close(in_pipe[1]);
+
+	s->out_fd = out_pipe[0];
+	s->running = true;
+}
+
+static void stop(struct strategy *s) {
+	if (s->running) {
+		kill(s->pid, SIGTERM);
+		waitpid(s->pid, NULL, 0);
+		close(s->out_fd);
+		s->running = false;
+	}
+}
+
+static void stop_all(void) {
+	for (size_t i = 0; i < MAX_STRATEGIES; i++) {
+		stop(&strategies[i]);
+	}
+}
+
+static void append_output(struct strategy *s, const char *buf, size_t n) {
+	// One extra byte is kept for the '\0', so the output can be searched with strstr()
+	if (s->output_length + n + 1 > s->output_capacity) {
+		s->output_capacity = (s->output_length + n + 1) * 2;
+		s->output = realloc(s->output, s->output_capacity);
+		if (!s->output) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(s->output + s->output_length, buf, n);
+	s->output_length += n;
+	s->output[s->output_length] = '\0';
+}
+
+// Reads whatever the strategy printed, and reaps it once its stdout is closed
+static void drain(struct strategy *s) {
+	char buf[65536];
+	ssize_t n = read(s->out_fd, buf, sizeof(buf));
+	if (n > 0) {
+		append_output(s, buf, n);
+		return;
+	}
+	if (n < 0 && errno == EINTR) {
+		return;
+	}
+
+	int status;
+	waitpid(s->pid, &status, 0);
+	close(s->out_fd);
+	s->running = false;
+
+	s->solved = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS && s->output && strstr(s->output, "Solved!");
+	fprintf(stderr, "%s %s\n", s->name, s->solved ? "found a solution" : "gave up");
+}
+
+static size_t read_rss(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return 0;
+	}
+	size_t size;
+	size_t resident = 0;
+	if (fscanf(f, "%zu %zu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// When the strategies use more memory than they are allowed to share,
+// the hungriest one is stopped, since it was going to run out first anyway
+static void enforce_max_memory(void) {
+	size_t total = 0;
+	struct strategy *hungriest = NULL;
+	for (size_t i = 0; i < MAX_STRATEGIES; i++) {
+		struct strategy *s = &strategies[i];
+		if (!s->running) {
+			continue;
+		}
+		s->rss = read_rss(s->pid);
+		total += s->rss;
+		if (!hungriest || s->rss > hungriest->rss) {
+			hungriest = s;
+		}
+	}
+
+	if (hungriest && total > max_memory) {
+		fprintf(stderr, "Stopping %s, since the strategies use %zu MiB out of %zu MiB\n", hungriest->name, total >> 20, max_memory >> 20);
+		stop(hungriest);
+	}
+}
+
+static bool any_running(void) {
+	for (size_t i = 0; i < MAX_STRATEGIES; i++) {
+		if (strategies[i].running) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// An optimal solution always wins right away,
+// while a non-optimal one has to wait for the optimal strategies until the deadline
+static struct strategy *pick_winner(double elapsed) {
+	struct strategy *fallback = NULL;
+	for (size_t i = 0; i < MAX_STRATEGIES; i++) {
+		struct strategy *s = &strategies[i];
+		if (!s->solved) {
+			continue;
+		}
+		if (s->optimal) {
+			return s;
+		}
+		fallback = fallback ? fallback : s;
+	}
+
+	if (fallback && (elapsed >= deadline || !any_running())) {
+		return fallback;
+	}
+	return NULL;
+}
+
+static void usage(const char *program) {
+	fprintf(stderr, "Usage: %s [--max-memory MiB] [--deadline seconds] [--bfs path] [--iddfs path] [--area path] [--level n] [--verbose] < levels.txt\n", program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	max_memory = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 4 * 3;
+	size_t level_number = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+			max_memory = strtoull(argv[++i], NULL, 10) << 20;
+		} else if (strcmp(argv[i], "--deadline") == 0 && i + 1 < argc) {
+			deadline = strtod(argv[++i], NULL);
+		} else if (strcmp(argv[i], "--bfs") == 0 && i + 1 < argc) {
+			strategies[0].path = argv[++i];
+		} else if (strcmp(argv[i], "--iddfs") == 0 && i + 1 < argc) {
+			strategies[1].path = argv[++i];
+		} else if (strcmp(argv[i], "--area") == 0 && i + 1 < argc) {
+			strategies[2].path = argv[++i];
+		} else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+			level_number = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--verbose") == 0) {
+			verbose = true;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	read_level(level_number);
+
+	// A strategy that gets stopped closes its end of the pipe, which mustn't kill the portfolio
+	signal(SIGPIPE, SIG_IGN);
+
+	double start_time = now();
+	for (size_t i = 0; i < MAX_STRATEGIES; i++) {
+		start(&strategies[i]);
+	}
+
+	struct strategy *winner = NULL;
+	while (!winner && any_running()) {
+		struct pollfd fds[MAX_STRATEGIES];
+		struct strategy *polled[MAX_STRATEGIES];
+		nfds_t nfds = 0;
+		for (size_t i = 0; i < MAX_STRATEGIES; i++) {
+			if (strategies[i].running) {
+				fds[nfds] = (struct pollfd){.fd=strategies[i].out_fd, .events=POLLIN};
+				polled[nfds++] = &strategies[i];
+			}
+		}
+
+		if (poll(fds, nfds, POLL_INTERVAL_MS) < 0 && errno != EINTR) {
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+
+		for (nfds_t i = 0; i < nfds; i++) {
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				drain(polled[i]);
+			}
+		}
+
+		enforce_max_memory();
+		winner = pick_winner(now() - start_time);
+	}
+
+	stop_all();
+
+	if (!winner) {
+		fprintf(stderr, "No solution was found :(\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("Solved by %s in %.3f seconds\n", winner->name, now() - start_time);
+	fwrite(winner->output, 1, winner->output_length, stdout);
+	exit(EXIT_SUCCESS);
+}
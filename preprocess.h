@@ -0,0 +1,246 @@
+// What every solver does to a level once it's read, before it searches it
+//
+// Boxes that are settled on a storage for good become walls, floor that the player can't ever reach becomes walls too,
+// and the map is cropped to what's left, with a border of walls around it. Then the push distances are filled in,
+// and the tiles that a box mustn't be pushed onto are found: with as many storages as boxes, a tile that no storage
+// can be reached from is dead, and with more boxes than storages, only the corners are,
+// since the boxes that are left over can be anywhere
+//
+// Maps are PREPROCESS_MAX_HEIGHT rows of PREPROCESS_MAX_WIDTH tiles, of which a level uses width x height
+
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "distances.h"
+
+#define PREPROCESS_MAX_HEIGHT 64
+#define PREPROCESS_MAX_WIDTH 64
+
+// A byte per tile, so that a row of PREPROCESS_MAX_WIDTH tiles is a single cache line
+enum __attribute__((packed)) tile {
+	FLOOR,
+	WALL,
+	BOX,
+	STORAGE,
+	STORED_BOX,
+};
+
+// The level that gets preprocessed, where the fields are updated to those of the cropped map
+struct preprocess {
+	enum tile (*map)[PREPROCESS_MAX_WIDTH];
+	bool (*frozen)[PREPROCESS_MAX_WIDTH]; // Boxes that became walls, which are still printed as boxes
+	size_t width;
+	size_t height;
+	size_t player_x;
+	size_t player_y;
+	size_t origin_x; // Where the cropped map starts in the level
+	size_t origin_y;
+};
+
+static bool preprocess_is_wall(const struct preprocess *p, size_t x, size_t y) {
+	return x >= p->width || y >= p->height || p->map[y][x] == WALL; // x-1 and y-1 wrap around when they go below 0
+}
+
+static bool preprocess_is_box(enum tile t) {
+	return t == BOX || t == STORED_BOX;
+}
+
+static bool preprocess_is_storage(enum tile t) {
+	return t == STORAGE || t == STORED_BOX;
+}
+
+static void preprocess_count(const struct preprocess *p, size_t *floors, size_t *boxes) {
+	*floors = 0;
+	*boxes = 0;
+	for (size_t y = 0; y < p->height; y++) {
+		for (size_t x = 0; x < p->width; x++) {
+			*floors += p->map[y][x] != WALL;
+			*boxes += preprocess_is_box(p->map[y][x]);
+		}
+	}
+}
+
+// A box on storage that has a wall above or below it, and a wall to the left or right of it,
+// can't be pushed ever again, so it may as well be a wall
+// Turning it into one can freeze the boxes next to it as well
+static void preprocess_freeze_settled_boxes(struct preprocess *p) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t y = 0; y < p->height; y++) {
+			for (size_t x = 0; x < p->width; x++) {
+				if (p->map[y][x] == STORED_BOX && (preprocess_is_wall(p, x, y-1) || preprocess_is_wall(p, x, y+1)) && (preprocess_is_wall(p, x-1, y) || preprocess_is_wall(p, x+1, y))) {
+					p->map[y][x] = WALL;
+					p->frozen[y][x] = true;
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+// Floor that the player can't reach even if the boxes weren't there,
+// like the floor outside of the walls, can't ever matter
+static void preprocess_trim_unreachable_floor(struct preprocess *p) {
+	static bool reachable[PREPROCESS_MAX_HEIGHT][PREPROCESS_MAX_WIDTH];
+	static size_t stack[PREPROCESS_MAX_HEIGHT * PREPROCESS_MAX_WIDTH];
+	size_t stack_size = 0;
+
+	memset(reachable, false, sizeof(reachable)); // bfs.c --serve preprocesses one level after another
+
+	reachable[p->player_y][p->player_x] = true;
+	stack[stack_size++] = p->player_x + p->player_y * PREPROCESS_MAX_WIDTH;
+
+	while (stack_size > 0) {
+		size_t x = stack[--stack_size] % PREPROCESS_MAX_WIDTH;
+		size_t y = stack[stack_size] / PREPROCESS_MAX_WIDTH;
+
+		size_t neighbors[4][2] = {{x, y-1}, {x, y+1}, {x-1, y}, {x+1, y}};
+		for (size_t i = 0; i < 4; i++) {
+			size_t nx = neighbors[i][0];
+			size_t ny = neighbors[i][1];
+			if (!preprocess_is_wall(p, nx, ny) && !reachable[ny][nx]) {
+				reachable[ny][nx] = true;
+				stack[stack_size++] = nx + ny * PREPROCESS_MAX_WIDTH;
+			}
+		}
+	}
+
+	for (size_t y = 0; y < p->height; y++) {
+		for (size_t x = 0; x < p->width; x++) {
+			if (!reachable[y][x] && p->map[y][x] == FLOOR) {
+				p->map[y][x] = WALL;
+			}
+		}
+	}
+}
+
+// Crops the map to the tiles that aren't walls, keeping a border of walls around them
+// The moves and the floodfill peek up to 3 tiles ahead, which the border guarantees stays inside the map
+static void preprocess_crop(struct preprocess *p) {
+	size_t min_x = p->width;
+	size_t min_y = p->height;
+	size_t max_x = 0;
+	size_t max_y = 0;
+	for (size_t y = 0; y < p->height; y++) {
+		for (size_t x = 0; x < p->width; x++) {
+			if (p->map[y][x] != WALL) {
+				min_x = x < min_x ? x : min_x;
+				min_y = y < min_y ? y : min_y;
+				max_x = x > max_x ? x : max_x;
+				max_y = y > max_y ? y : max_y;
+			}
+		}
+	}
+
+	p->origin_x = min_x > 0 ? min_x - 1 : 0;
+	p->origin_y = min_y > 0 ? min_y - 1 : 0;
+	size_t new_width = (max_x + 1 < p->width ? max_x + 2 : p->width) - p->origin_x;
+	size_t new_height = (max_y + 1 < p->height ? max_y + 2 : p->height) - p->origin_y;
+
+	for (size_t y = 0; y < PREPROCESS_MAX_HEIGHT; y++) {
+		for (size_t x = 0; x < PREPROCESS_MAX_WIDTH; x++) {
+			bool inside = x < new_width && y < new_height;
+			p->map[y][x] = inside ? p->map[y + p->origin_y][x + p->origin_x] : WALL;
+			p->frozen[y][x] = inside ? p->frozen[y + p->origin_y][x + p->origin_x] : false;
+		}
+	}
+
+	p->width = new_width;
+	p->height = new_height;
+	p->player_x -= p->origin_x;
+	p->player_y -= p->origin_y;
+}
+
+static void preprocess_level(struct preprocess *p) {
+	size_t old_width = p->width;
+	size_t old_height = p->height;
+	size_t old_floors;
+	size_t old_boxes;
+	preprocess_count(p, &old_floors, &old_boxes);
+
+	preprocess_freeze_settled_boxes(p);
+	preprocess_trim_unreachable_floor(p);
+	preprocess_crop(p);
+
+	size_t floors;
+	size_t boxes;
+	preprocess_count(p, &floors, &boxes);
+
+	printf("preprocessing: %zux%zu -> %zux%zu tiles, %zu -> %zu floor tiles, %zu -> %zu boxes, %zu -> %zu chars per map string\n\n",
+		old_width, old_height, p->width, p->height,
+		old_floors, floors,
+		old_boxes, boxes,
+		(old_width + 1) * old_height, (p->width + 1) * p->height);
+}
+
+// Fills in the push distances of the preprocessed level, and which tiles are dead
+// Returns whether the boxes' pushes to their nearest storages are a lower bound, which needs as many storages as boxes,
+// and sets stuck when a box already is on a dead tile, so that no solution exists
+static bool preprocess_dead_tiles(const struct preprocess *p, struct distances *d, bool dead_tiles[][PREPROCESS_MAX_WIDTH], bool *stuck) {
+	static bool walls[DISTANCES_MAX_TILES];
+	static bool storages[DISTANCES_MAX_TILES];
+	size_t storages_size = 0;
+	size_t boxes = 0;
+	for (size_t y = 0; y < p->height; y++) {
+		for (size_t x = 0; x < p->width; x++) {
+			walls[x + y * p->width] = preprocess_is_wall(p, x, y);
+			storages[x + y * p->width] = preprocess_is_storage(p->map[y][x]);
+			storages_size += storages[x + y * p->width];
+			boxes += preprocess_is_box(p->map[y][x]);
+		}
+	}
+	distances_init(d, walls, storages, p->width, p->height);
+	distances_print(d);
+
+	*stuck = false;
+	for (size_t y = 0; y < p->height; y++) {
+		for (size_t x = 0; x < p->width; x++) {
+			bool corner = (preprocess_is_wall(p, x, y-1) || preprocess_is_wall(p, x, y+1)) && (preprocess_is_wall(p, x-1, y) || preprocess_is_wall(p, x+1, y));
+			dead_tiles[y][x] = boxes <= storages_size ? distances_dead(d, x + y * p->width) : corner && !storages[x + y * p->width];
+			*stuck |= preprocess_is_box(p->map[y][x]) && dead_tiles[y][x] && boxes <= storages_size;
+		}
+	}
+
+	return boxes == storages_size;
+}
+
+// Makes a move of a cached path on the preprocessed level: walking onto the next tile, or pushing the box on it a tile further
+// Returns false when the move can't be made, so that a cache entry that doesn't fit the level isn't printed as its solution
+static bool preprocess_replay_move(struct preprocess *p, int dx, int dy, bool push) {
+	size_t x = p->player_x + dx;
+	size_t y = p->player_y + dy;
+	if (preprocess_is_wall(p, x, y) || preprocess_is_box(p->map[y][x]) != push) {
+		return false;
+	}
+	if (push) {
+		size_t box_x = x + dx;
+		size_t box_y = y + dy;
+		if (preprocess_is_wall(p, box_x, box_y) || preprocess_is_box(p->map[box_y][box_x])) {
+			return false;
+		}
+		p->map[y][x] = p->map[y][x] == STORED_BOX ? STORAGE : FLOOR;
+		p->map[box_y][box_x] = p->map[box_y][box_x] == STORAGE ? STORED_BOX : BOX;
+	}
+	p->player_x = x;
+	p->player_y = y;
+	return true;
+}
+
+// Counts the storages that don't have a box on them yet, which a replayed solution must leave none of
+static size_t preprocess_empty_storages(const struct preprocess *p) {
+	size_t empty_storages = 0;
+	for (size_t y = 0; y < p->height; y++) {
+		for (size_t x = 0; x < p->width; x++) {
+			empty_storages += p->map[y][x] == STORAGE;
+		}
+	}
+	return empty_storages;
+}
+
+#endif
@@ -0,0 +1,64 @@
+// Ranks the boxes of a map to a dense number, using the combinatorial number system from
+// https://en.wikipedia.org/wiki/Combinatorial_number_system
+//
+// Squares are the tiles that a box can be on, numbered from 0. Boxes on squares c_1 < c_2 < ... < c_k
+// get the rank C(c_1, 1) + C(c_2, 2) + ... + C(c_k, k), which runs from 0 up to C(squares, k) - 1 without any gaps,
+// so a table with one entry per rank needs no hashing, no collision handling and no stored keys
+
+#ifndef RANK_H
+#define RANK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RANK_MAX_SQUARES 4096
+#define RANK_MAX_BOXES 64 // Only the binomials up to the number of boxes are ever needed, which keeps the table small for big maps
+#define RANK_SATURATED UINT64_MAX // Any count that doesn't fit in a uint64_t
+
+struct ranking {
+	size_t squares;
+	size_t boxes;
+	uint64_t binomials[RANK_MAX_SQUARES + 1][RANK_MAX_BOXES + 1];
+};
+
+static uint64_t rank_add(uint64_t a, uint64_t b) {
+	return a > RANK_SATURATED - b ? RANK_SATURATED : a + b;
+}
+
+static uint64_t rank_multiply(uint64_t a, uint64_t b) {
+	return b != 0 && a > RANK_SATURATED / b ? RANK_SATURATED : a * b;
+}
+
+static void rank_init(struct ranking *r, size_t squares, size_t boxes) {
+	r->squares = squares;
+	r->boxes = boxes;
+
+	// Pascal's triangle, only as far as this map's squares and boxes go
+	size_t max_n = squares < RANK_MAX_SQUARES ? squares : RANK_MAX_SQUARES;
+	size_t max_k = boxes < RANK_MAX_BOXES ? boxes : RANK_MAX_BOXES;
+	for (size_t n = 0; n <= max_n; n++) {
+		r->binomials[n][0] = 1;
+		for (size_t k = 1; k <= max_k; k++) {
+			r->binomials[n][k] = n == 0 ? 0 : rank_add(r->binomials[n - 1][k - 1], r->binomials[n - 1][k]);
+		}
+	}
+}
+
+// The number of ways the boxes can be spread over the squares
+static uint64_t rank_size(const struct ranking *r) {
+	if (r->squares > RANK_MAX_SQUARES || r->boxes > RANK_MAX_BOXES) {
+		return RANK_SATURATED;
+	}
+	return r->binomials[r->squares][r->boxes];
+}
+
+// squares has to be sorted from low to high, and contain r->boxes squares
+static uint64_t rank_boxes(const struct ranking *r, const uint16_t *squares) {
+	uint64_t rank = 0;
+	for (size_t i = 0; i < r->boxes; i++) {
+		rank += r->binomials[squares[i]][i + 1];
+	}
+	return rank;
+}
+
+#endif
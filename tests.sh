@@ -9,6 +9,8 @@
 gcc area.c -lm -Wall -Wextra -Werror -Wpedantic -Wshadow -Wfatal-errors -g -Ofast -march=native
 # gcc area.c -lm -Wall -Wextra -Werror -Wpedantic -Wshadow -Wfatal-errors -g -fsanitize=address,undefined
 
+# gcc bfs.c -o bfs -lm -Wall -Wextra -Werror -Wpedantic -Wshadow -Wfatal-errors -g -Ofast -march=native && gcc iddfs.c -o iddfs -lm -Wall -Wextra -Werror -Wpedantic -Wshadow -Wfatal-errors -g -Ofast -march=native && gcc area.c -o area -lm -Wall -Wextra -Werror -Wpedantic -Wshadow -Wfatal-errors -g -Ofast -march=native && gcc portfolio.c -o a.out -Wall -Wextra -Werror -Wpedantic -Wshadow -Wfatal-errors -g -O2
+
 if [[ $? -ne 0 ]]
 then
 	echo "Compilation failed"